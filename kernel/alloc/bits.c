@@ -1,56 +1,105 @@
 #include "bits.h"
 #include "../defs.h"
 
+#define WORD(index) ((index) / 64)
+#define MASK(index) (1UL << ((index) % 64))
+
+/// Index of the lowest 1 bit of a non-zero word.
+/// Written out, since the kernel does not link libgcc.
+static int word_ctz(uint64 word) {
+  int n = 0;
+  if ((word & 0xFFFFFFFFUL) == 0) {
+    n += 32;
+    word >>= 32;
+  }
+  if ((word & 0xFFFF) == 0) {
+    n += 16;
+    word >>= 16;
+  }
+  if ((word & 0xFF) == 0) {
+    n += 8;
+    word >>= 8;
+  }
+  if ((word & 0xF) == 0) {
+    n += 4;
+    word >>= 4;
+  }
+  if ((word & 0x3) == 0) {
+    n += 2;
+    word >>= 2;
+  }
+  if ((word & 0x1) == 0) {
+    n += 1;
+  }
+  return n;
+}
+
 /// Return 1 if bit at position index in array is set to 1
 bool bits_is_set(bits bits, int index) {
-  const byte cell = bits.as_bytes[index / 8];
-  const byte mask = (1 << (index % 8));
-  return (cell & mask) == mask;
+  return (bits.as_words[WORD(index)] & MASK(index)) != 0;
 }
 
 /// Set bit at position index in array to 1
 void bits_set(bits bits, int index) {
-  const byte cell = bits.as_bytes[index / 8];
-  const byte mask = (1 << (index % 8));
-  bits.as_bytes[index / 8] = (cell | mask);
+  bits.as_words[WORD(index)] |= MASK(index);
 }
 
 /// Clear bit at position index in array
 void bits_clear(bits bits, int index) {
-  const byte cell = bits.as_bytes[index / 8];
-  const byte mask = (1 << (index % 8));
-  bits.as_bytes[index / 8] = (cell & ~mask);
+  bits.as_words[WORD(index)] &= ~MASK(index);
 }
 
 void bits_switch(bits bits, int index) {
-  if (bits_is_set(bits, index)) {
-    bits_clear(bits, index);
-  } else {
-    bits_set(bits, index);
-  }
+  bits.as_words[WORD(index)] ^= MASK(index);
 }
 
-/// Print a bit vector as a list of ranges of 1 bits
-void bits_print(fat_bits bits) {
-  int last_bit = 1;
-  int last_bit_index = 0;
+/// Scan [from, len) for the first bit equal to `set`,
+/// skipping whole words that cannot contain it.
+static int bits_find_next(bits bits, int from, int len, bool set) {
+  if (len <= from) {
+    return len;
+  }
+  int w = WORD(from);
+  uint64 word = bits.as_words[w];
+  if (set != 1) {
+    word = ~word;
+  }
+  word &= ~0UL << (from % 64);
 
-  for (int bit_index = 0; bit_index < bits.len; bit_index++) {
-    if (last_bit == bits_is_set(bits.bits, bit_index)) {
-      continue;
+  while (word == 0) {
+    w++;
+    if (len <= w * 64) {
+      return len;
     }
-
-    if (last_bit == 1) {
-      printf(" [%d, %d)", last_bit_index, bit_index);
+    word = bits.as_words[w];
+    if (set != 1) {
+      word = ~word;
     }
-
-    last_bit_index = bit_index;
-    last_bit = bits_is_set(bits.bits, bit_index);
   }
 
-  if (last_bit_index == 0 || last_bit == 1) {
-    printf(" [%d, %d)", last_bit_index, bits.len);
-  }
+  int index = w * 64 + word_ctz(word);
+  return (index < len) ? index : len;
+}
 
+int bits_find_first_zero(bits bits, int len) {
+  return bits_find_next(bits, 0, len, 0);
+}
+
+int bits_find_next_zero(bits bits, int from, int len) {
+  return bits_find_next(bits, from, len, 0);
+}
+
+int bits_find_next_set(bits bits, int from, int len) {
+  return bits_find_next(bits, from, len, 1);
+}
+
+/// Print a bit vector as a list of ranges of 1 bits
+void bits_print(fat_bits bits) {
+  int from = bits_find_next_set(bits.bits, 0, bits.len);
+  while (from < bits.len) {
+    int to = bits_find_next_zero(bits.bits, from, bits.len);
+    printf(" [%d, %d)", from, to);
+    from = bits_find_next_set(bits.bits, to, bits.len);
+  }
   printf("\n");
 }
@@ -3,8 +3,11 @@
 
 #include "../core/type.h"
 
+/// Bit vector stored in 64-bit words. Bit i lives in word
+/// i / 64 at position i % 64, which on a little-endian
+/// machine matches the layout of a byte-wise bitmap.
 typedef struct {
-  byte* as_bytes;
+  uint64* as_words;
 } bits;
 
 typedef struct {
@@ -12,6 +15,9 @@ typedef struct {
   int len;
 } fat_bits;
 
+/// Number of words needed to hold n bits
+#define BITS_WORDS(n) (((n) + 63) / 64)
+
 bool bits_is_set(bits bits, int index);
 
 void bits_set(bits bits, int index);
@@ -20,6 +26,15 @@ void bits_clear(bits bits, int index);
 
 void bits_switch(bits bits, int index);
 
+/// Index of the first 0 bit in [0, len), or len if there is none.
+int bits_find_first_zero(bits bits, int len);
+
+/// Index of the first 0 bit in [from, len), or len if there is none.
+int bits_find_next_zero(bits bits, int from, int len);
+
+/// Index of the first 1 bit in [from, len), or len if there is none.
+int bits_find_next_set(bits bits, int from, int len);
+
 void bits_print(fat_bits bits);
 
-#endif // XV6_KERNEL_BITVEC_H
\ No newline at end of file
+#endif // XV6_KERNEL_BITVEC_H
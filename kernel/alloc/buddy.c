@@ -7,9 +7,16 @@
 #include "buddy.h"
 #include "list.h"
 #include "bits.h"
+#include "page.h"
+#include "memstat.h"
 
-// The smallest block size
-#define LEAF_SIZE 16
+// The smallest block size is a page; smaller objects
+// come from the slab allocator (see slab.h).
+#define LEAF_SHIFT PGSHIFT
+#define LEAF_SIZE (1 << LEAF_SHIFT)
+
+// Leaf size the allocator used to have, for the boot report
+#define OLD_LEAF_SHIFT 4
 
 // Largest index in bd_sizes array
 #define MAXSIZE (buddy_size_groups_count - 1)
@@ -25,15 +32,14 @@
 #define ROUNDUP(n, sz) (((((n)-1) / (sz)) + 1) * (sz))
 
 // The allocator has sz_info for each size k. Each sz_info has a free
-// list, an array alloc to keep track which blocks have been
-// allocated, and an split array to to keep track which blocks have
-// been split.  The arrays are of type char (which is 1 byte), but the
-// allocator uses 1 bit per block (thus, one char records the info of
-// 8 blocks).
+// list and an array alloc to keep track which blocks have been
+// allocated. The array is a bit vector of 64-bit words (see bits.h),
+// one bit per pair of blocks (thus, one word records the info of
+// 64 pairs). The size of an allocated block is kept in the
+// descriptor of its first page.
 typedef struct {
   struct list freelist;
   bits pair_alloc_xor;
-  bits split;
 } buddy_size_group_info;
 
 // The array of `buddy_size_info`
@@ -43,9 +49,24 @@ static int buddy_size_groups_count;
 // Start address of memory managed by the buddy allocator
 static void* buddy_base;
 
+// Descriptor of every page in [buddy_base, buddy_base + HEAP_SIZE)
+static struct page* buddy_pages;
+
 // Lock
 static struct spinlock buddy_lock;
 
+// Number of unmerged frees after which lazy mode coalesces
+#define LAZY_WATERMARK 1024
+
+// In lazy mode buddy_free leaves blocks at their size, and
+// free buddies are merged only by buddy_coalesce_locked().
+static int buddy_lazy;
+static int buddy_lazy_count;
+
+// Blocks handed out and given back, protected by buddy_lock
+static uint64 buddy_nalloc;
+static uint64 buddy_nfree;
+
 int buddy_pair_index(int block_index) {
   if (block_index % 2 == 1) {
     block_index -= 1;
@@ -60,10 +81,6 @@ void buddy_print() {
     lst_print(&buddy_size_groups[k].freelist);
     printf("  pair_xor_alloc:");
     bits_print((fat_bits){buddy_size_groups[k].pair_alloc_xor, NBLK(k) / 2});
-    if (k > 0) {
-      printf("  split:");
-      bits_print((fat_bits){buddy_size_groups[k].split, NBLK(k)});
-    }
   }
 }
 
@@ -90,59 +107,113 @@ void* addr(int k, int bi) {
   return (char*)buddy_base + n;
 }
 
-// allocate nbytes, but malloc won't return anything smaller than LEAF_SIZE
-void* buddy_malloc(uint64 nbytes) {
-  int fk, k;
+struct page* page_get(void* pa) {
+  return &buddy_pages[((char*)pa - (char*)buddy_base) >> PGSHIFT];
+}
 
-  acquire(&buddy_lock);
+int page_ref_inc(void* pa) {
+  return __sync_add_and_fetch(&page_get(pa)->refcnt, 1);
+}
+
+int page_ref_dec(void* pa) {
+  return __sync_sub_and_fetch(&page_get(pa)->refcnt, 1);
+}
+
+static void buddy_coalesce_locked(void);
+
+// Pop a free block of size fk, splitting a larger one if needed.
+// Caller must hold buddy_lock.
+static void* buddy_malloc_locked(int fk) {
+  int k;
+
+  if (buddy_lazy && buddy_lazy_count > 0) {
+    // a request may only fail once free buddies are merged.
+    for (k = fk; k < buddy_size_groups_count; k++) {
+      if (!lst_empty(&buddy_size_groups[k].freelist))
+        break;
+    }
+    if (k >= buddy_size_groups_count)
+      buddy_coalesce_locked();
+  }
 
   // Find a free block >= nbytes, starting with smallest k possible
-  fk = firstk(nbytes);
   for (k = fk; k < buddy_size_groups_count; k++) {
     if (!lst_empty(&buddy_size_groups[k].freelist))
       break;
   }
   if (k >= buddy_size_groups_count) { // No free blocks?
-    release(&buddy_lock);
     return 0;
   }
 
   // Found a block; pop it and potentially split it.
+  buddy_nalloc++;
   char* p = lst_pop(&buddy_size_groups[k].freelist);
   bits_switch(buddy_size_groups[k].pair_alloc_xor, buddy_pair_index(blk_index(k, p)));
   for (; k > fk; k--) {
     // split a block at size k and mark one half allocated at size k-1
     // and put the buddy on the free list at size k-1
     char* q = p + BLK_SIZE(k - 1); // p's buddy
-    bits_set(buddy_size_groups[k].split, blk_index(k, p));
     bits_switch(
         buddy_size_groups[k - 1].pair_alloc_xor, buddy_pair_index(blk_index(k - 1, p))
     );
     lst_push(&buddy_size_groups[k - 1].freelist, q);
   }
-  release(&buddy_lock);
+  struct page* page = page_get(p);
+  page->order = fk;
+  page->flags = PAGE_ALLOCATED;
+  page->refcnt = 1;
+  return p;
+}
 
+// allocate nbytes, but malloc won't return anything smaller than a page
+void* buddy_malloc(uint64 nbytes) {
+  acquire(&buddy_lock);
+  void* p = buddy_malloc_locked(firstk(nbytes));
+  release(&buddy_lock);
   return p;
 }
 
+// Allocate up to n blocks of nbytes each into addrs under a single
+// acquisition of buddy_lock. Returns the number of blocks allocated.
+int buddy_malloc_batch(uint64 nbytes, void** addrs, int n) {
+  int fk = firstk(nbytes);
+  int i;
+
+  acquire(&buddy_lock);
+  for (i = 0; i < n; i++) {
+    if ((addrs[i] = buddy_malloc_locked(fk)) == 0)
+      break;
+  }
+  release(&buddy_lock);
+  return i;
+}
+
 // Find the size of the block that p points to.
 int size(char* p) {
-  for (int k = 0; k < buddy_size_groups_count; k++) {
-    if (bits_is_set(buddy_size_groups[k + 1].split, blk_index(k + 1, p))) {
-      return k;
-    }
-  }
-  return 0;
+  return page_get(p)->order;
 }
 
-// Free memory pointed to by p, which was earlier allocated using
-// bd_malloc.
-void buddy_free(void* p) {
+// Return block p to the free lists, merging it with its buddies.
+// Caller must hold buddy_lock.
+static void buddy_free_locked(void* p) {
   void* q;
   int k;
 
-  acquire(&buddy_lock);
-  for (k = size(p); k < MAXSIZE; k++) {
+  buddy_nfree++;
+  k = size(p);
+  struct page* page = page_get(p);
+  page->flags &= ~PAGE_ALLOCATED;
+  page->refcnt = 0;
+  if (buddy_lazy) {
+    // leave the block at its size, a merge may
+    // well be followed by a split of the same block.
+    bits_switch(buddy_size_groups[k].pair_alloc_xor, buddy_pair_index(blk_index(k, p)));
+    lst_push(&buddy_size_groups[k].freelist, p);
+    if (++buddy_lazy_count > LAZY_WATERMARK)
+      buddy_coalesce_locked();
+    return;
+  }
+  for (; k < MAXSIZE; k++) {
     int bi = blk_index(k, p);
     int pi = buddy_pair_index(bi);
     int buddy = (bi % 2 == 0) ? bi + 1 : bi - 1;
@@ -157,11 +228,129 @@ void buddy_free(void* p) {
     if (buddy % 2 == 0) {
       p = q;
     }
-    // at size k+1, mark that the merged buddy pair isn't split
-    // anymore
-    bits_clear(buddy_size_groups[k + 1].split, blk_index(k + 1, p));
   }
   lst_push(&buddy_size_groups[k].freelist, p);
+}
+
+// Turn the allocated block at p into single pages, each
+// allocated and holding the block's references, that are
+// given back one by one. The pair bits stay as they are:
+// inside an allocated block they record pairs of blocks
+// in the same state, which all-allocated pages also are.
+void buddy_split(void* p) {
+  acquire(&buddy_lock);
+  struct page* page = page_get(p);
+  int n = 1 << page->order;
+  for (int i = 1; i < n; i++) {
+    page[i].order = 0;
+    page[i].flags = PAGE_ALLOCATED;
+    page[i].refcnt = page->refcnt;
+  }
+  page->order = 0;
+  buddy_nalloc += n - 1;
+  release(&buddy_lock);
+}
+
+// Merge all pairs of free buddies, from the smallest size up,
+// as eager buddy_free_locked() would have done.
+// Caller must hold buddy_lock.
+static void buddy_coalesce_locked(void) {
+  struct list pending;
+
+  for (int k = 0; k < MAXSIZE; k++) {
+    struct list* freelist = &buddy_size_groups[k].freelist;
+    if (lst_empty(freelist))
+      continue;
+
+    // move the free list of size k aside
+    pending.next = freelist->next;
+    pending.prev = freelist->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    lst_init(freelist);
+
+    while (!lst_empty(&pending)) {
+      char* p = lst_pop(&pending);
+      int bi = blk_index(k, p);
+      if (bits_is_set(buddy_size_groups[k].pair_alloc_xor, buddy_pair_index(bi))) {
+        // buddy is allocated
+        lst_push(freelist, p);
+        continue;
+      }
+      // buddy is free, either still pending or back on the free list
+      int buddy = (bi % 2 == 0) ? bi + 1 : bi - 1;
+      char* q = addr(k, buddy);
+      lst_remove((struct list*)q);
+      if (buddy % 2 == 0) {
+        p = q;
+      }
+      // the merged block is free at size k+1
+      bits_switch(
+          buddy_size_groups[k + 1].pair_alloc_xor,
+          buddy_pair_index(blk_index(k + 1, p))
+      );
+      lst_push(&buddy_size_groups[k + 1].freelist, p);
+    }
+  }
+  buddy_lazy_count = 0;
+}
+
+// Switch between eager and lazy coalescing.
+void buddy_set_lazy(int lazy) {
+  acquire(&buddy_lock);
+  if (!lazy) {
+    buddy_coalesce_locked();
+  }
+  buddy_lazy = lazy;
+  release(&buddy_lock);
+}
+
+// Free memory pointed to by p, which was earlier allocated using
+// bd_malloc.
+void buddy_free(void* p) {
+  acquire(&buddy_lock);
+  buddy_free_locked(p);
+  release(&buddy_lock);
+}
+
+// Free n blocks under a single acquisition of buddy_lock.
+void buddy_free_batch(void** addrs, int n) {
+  acquire(&buddy_lock);
+  for (int i = 0; i < n; i++) {
+    buddy_free_locked(addrs[i]);
+  }
+  release(&buddy_lock);
+}
+
+// Fill in the buddy allocator part of st.
+void buddy_stat(struct memstat* st) {
+  uint64 largest = 0;
+
+  acquire(&buddy_lock);
+  st->leaf_size = LEAF_SIZE;
+  st->nsizes = buddy_size_groups_count;
+  if (st->nsizes > MEMSTAT_NSIZES)
+    st->nsizes = MEMSTAT_NSIZES;
+  st->free_bytes = 0;
+  for (int k = 0; k < buddy_size_groups_count; k++) {
+    int n = 0;
+    struct list* freelist = &buddy_size_groups[k].freelist;
+    for (struct list* e = freelist->next; e != freelist; e = e->next)
+      n++;
+    if (k < MEMSTAT_NSIZES)
+      st->free_blocks[k] = n;
+    st->free_bytes += (uint64)n * BLK_SIZE(k);
+    if (n > 0)
+      largest = BLK_SIZE(k);
+  }
+  // share of free memory outside of the largest free block
+  st->frag = 0;
+  if (st->free_bytes > 0)
+    st->frag = 1000 - (int)(largest * 1000 / st->free_bytes);
+  st->buddy_allocs = buddy_nalloc;
+  st->buddy_frees = buddy_nfree;
+  st->buddy_lock_acquires = buddy_lock.nacquire;
+  st->buddy_lock_contended = buddy_lock.ncontended;
   release(&buddy_lock);
 }
 
@@ -183,6 +372,11 @@ int log2(uint64 n) {
 }
 
 // Mark memory from [start, stop), starting at size 0, as allocated.
+//
+// At every size k each pair_alloc_xor bit would be toggled once
+// per block of the pair in the range [bi, bj), so pairs lying
+// entirely inside the range end up unchanged, and only the pairs
+// at the two ends of the range need to be flipped.
 void bd_mark(void* start, void* stop) {
   int bi, bj;
 
@@ -192,13 +386,15 @@ void bd_mark(void* start, void* stop) {
   for (int k = 0; k < buddy_size_groups_count; k++) {
     bi = blk_index(k, start);
     bj = blk_index_next(k, stop);
-    for (; bi < bj; bi++) {
-      if (k > 0) {
-        // if a block is allocated at size k, mark it as split too.
-        bits_set(buddy_size_groups[k].split, bi);
-      }
+    if (bj <= bi) {
+      continue;
+    }
+    if (bi % 2 == 1) {
       bits_switch(buddy_size_groups[k].pair_alloc_xor, buddy_pair_index(bi));
     }
+    if (bj % 2 == 1) {
+      bits_switch(buddy_size_groups[k].pair_alloc_xor, buddy_pair_index(bj - 1));
+    }
   }
 }
 
@@ -268,11 +464,28 @@ int bd_mark_unavailable(void* end, void* left) {
   return unavailable;
 }
 
+// Bytes of the size array and bitmaps for nsizes sizes. With
+// with_split, also count the split bitmaps and the size array
+// entries the allocator needed with leaves smaller than a page.
+static uint64 bd_bitmap_bytes(int nsizes, int with_split) {
+  uint64 n = (sizeof(buddy_size_group_info) + (with_split ? sizeof(bits) : 0)) * nsizes;
+  for (int k = 0; k < nsizes; k++) {
+    uint64 nblk = 1L << (nsizes - 1 - k);
+    n += sizeof(uint64) * BITS_WORDS(nblk / 2 > 0 ? nblk / 2 : 1);
+    if (with_split && k > 0)
+      n += sizeof(uint64) * BITS_WORDS(nblk);
+  }
+  return n;
+}
+
 // Initialize the buddy allocator: it manages memory from [base, end).
 void buddy_init(void* base, void* end) {
   byte* p = (byte*)ROUNDUP((uint64)base, LEAF_SIZE);
   int sz;
 
+  if ((uint64)p % PGSIZE != 0)
+    panic("buddy_init: base");
+
   initlock(&buddy_lock, "buddy");
   buddy_base = (void*)p;
 
@@ -292,25 +505,32 @@ void buddy_init(void* base, void* end) {
   buddy_size_groups = (buddy_size_group_info*)p;
   p += sizeof(buddy_size_group_info) * buddy_size_groups_count;
   memset(buddy_size_groups, 0, sizeof(buddy_size_group_info) * buddy_size_groups_count);
+  p = (byte*)ROUNDUP((uint64)p, sizeof(uint64));
 
-  // initialize free list and allocate the alloc array for each size k
+  // initialize free list and allocate the alloc array for each size k,
+  // one bit per pair of blocks
   for (int k = 0; k < buddy_size_groups_count; k++) {
     lst_init(&buddy_size_groups[k].freelist);
-    sz = sizeof(char) * ROUNDUP(NBLK(k), 8) / 8;
-    sz = sz / 2 > 0 ? sz / 2 : 1;
-    buddy_size_groups[k].pair_alloc_xor.as_bytes = p;
-    memset(buddy_size_groups[k].pair_alloc_xor.as_bytes, 0, sz);
+    sz = sizeof(uint64) * BITS_WORDS(NBLK(k) / 2 > 0 ? NBLK(k) / 2 : 1);
+    buddy_size_groups[k].pair_alloc_xor.as_words = (uint64*)p;
+    memset(buddy_size_groups[k].pair_alloc_xor.as_words, 0, sz);
     p += sz;
   }
 
-  // allocate the split array for each size k, except for k = 0, since
-  // we will not split blocks of size k = 0, the smallest size.
-  for (int k = 1; k < buddy_size_groups_count; k++) {
-    sz = sizeof(char) * (ROUNDUP(NBLK(k), 8)) / 8;
-    buddy_size_groups[k].split.as_bytes = p;
-    memset(buddy_size_groups[k].split.as_bytes, 0, sz);
-    p += sz;
-  }
+  uint64 old = bd_bitmap_bytes(buddy_size_groups_count + LEAF_SHIFT - OLD_LEAF_SHIFT, 1);
+  uint64 now = bd_bitmap_bytes(buddy_size_groups_count, 0);
+  printf(
+      "bd: %d bitmap bytes, %d less than with %d-byte leaves\n",
+      (int)now,
+      (int)(old - now),
+      1 << OLD_LEAF_SHIFT
+  );
+
+  // allocate a descriptor for every page of the heap
+  sz = sizeof(struct page) * (HEAP_SIZE / PGSIZE);
+  buddy_pages = (struct page*)ROUNDUP((uint64)p, sizeof(struct page));
+  memset(buddy_pages, 0, sz);
+  p = (byte*)buddy_pages + sz;
   p = (byte*)ROUNDUP((uint64)p, LEAF_SIZE);
 
   // done allocating; mark the memory range [base, p) as allocated, so
@@ -9,12 +9,36 @@
 /// it manages memory from [base, end).
 void buddy_init(void* base, void* end);
 
-/// allocate nbytes, but malloc won't return anything
-/// smaller than LEAF_SIZE
+/// allocate nbytes, rounded up to a power of two pages;
+/// smaller objects come from kmalloc (see slab.h)
 void* buddy_malloc(uint64 nbytes);
 
 /// Free memory pointed to by p, which was earlier
 /// allocated using bd_malloc.
 void buddy_free(void* addr);
 
+/// Allocate up to n blocks of nbytes each into addrs,
+/// taking the allocator lock once. Returns the number
+/// of blocks actually allocated.
+int buddy_malloc_batch(uint64 nbytes, void** addrs, int n);
+
+/// Free n blocks from addrs, taking the allocator lock once.
+void buddy_free_batch(void** addrs, int n);
+
+/// Turn an allocated block into as many single pages, each
+/// with the block's reference count, to be freed one by one.
+void buddy_split(void* p);
+
+/// Choose between eager coalescing (0), where buddy_free merges
+/// a block with its free buddies right away, and lazy coalescing
+/// (1), where freed blocks stay at their size until a request
+/// cannot be served or too many frees went unmerged.
+void buddy_set_lazy(int lazy);
+
+struct memstat;
+
+/// Fill in block counts, free bytes, fragmentation and
+/// lock counters of the buddy allocator in st.
+void buddy_stat(struct memstat* st);
+
 #endif // XV6_KERNEL_BUDDY_H
\ No newline at end of file
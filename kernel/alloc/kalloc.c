@@ -10,26 +10,369 @@
 #include "kernel/defs.h"
 
 #include "buddy.h"
+#include "memctl.h"
+#include "memstat.h"
+#include "page.h"
+#include "slab.h"
+
+/// Capacity of a per-CPU page magazine.
+#define KMAG_SIZE 64
+
+/// Number of pages moved between a magazine
+/// and the buddy allocator at once.
+#define KMAG_BATCH (KMAG_SIZE / 2)
+
+/// Per-CPU cache of free pages sitting in front of the
+/// buddy allocator. Each CPU allocates from and frees to
+/// its own magazine; only refills and drains go to the
+/// buddy allocator, in batches of KMAG_BATCH pages.
+/// The lock is only contended when another CPU steals.
+struct kmagazine {
+  struct spinlock lock;
+  int count;
+  void* pages[KMAG_SIZE];
+
+  uint64 hits;    // kalloc served from the magazine
+  uint64 misses;  // kalloc found the magazine empty
+  uint64 frees;   // kfree put a page into the magazine
+  uint64 refills; // batches taken from the buddy allocator
+  uint64 drains;  // batches given back to the buddy allocator
+  uint64 steals;  // pages taken from other CPUs' magazines
+};
+
+static struct kmagazine kmags[NCPU];
+
+/// Number of pages kept zeroed ahead of time.
+#define KZERO_POOL 128
+
+/// Pool of pre-zeroed pages for kalloc_zeroed().
+/// Refilled by idle CPUs, see kzero_refill().
+static struct {
+  struct spinlock lock;
+  int count;
+  void* pages[KZERO_POOL];
+
+  uint64 hits;   // kalloc_zeroed served from the pool
+  uint64 misses; // kalloc_zeroed had to zero inline
+} kzero;
 
 /// First address after kernel, defined by `kernel.ld`.
 extern char end[];
 
 void kinit() {
+  uint64 start = r_cycle();
+
   char* p = (char*)PGROUNDUP((uint64)end);
   buddy_init(p, (void*)PHYSTOP);
+  for (int i = 0; i < NCPU; i++) {
+    initlock(&kmags[i].lock, "kmag");
+  }
+  initlock(&kzero.lock, "kzero");
+  kmalloc_init();
+
+  printf("kinit: %d kcycles\n", (int)((r_cycle() - start) / 1000));
+}
+
+/// Take one page from a magazine of another CPU.
+/// Used as a last resort when the buddy allocator
+/// is exhausted, so that pages cached by idle CPUs
+/// are not lost for the rest of the system.
+static void* kmag_steal(int self) {
+  void* pa = 0;
+
+  for (int i = 0; i < NCPU && pa == 0; i++) {
+    if (i == self) {
+      continue;
+    }
+    struct kmagazine* mag = &kmags[i];
+    acquire(&mag->lock);
+    if (mag->count > 0) {
+      pa = mag->pages[--mag->count];
+    }
+    release(&mag->lock);
+  }
+
+  if (pa) {
+    __sync_fetch_and_add(&kmags[self].steals, 1);
+  }
+  return pa;
 }
 
-/// Free the page of physical memory pointed at by v,
-/// which normally should have been returned by a
-/// call to kalloc().  (The exception is when
-/// initializing the allocator; see kinit above.)
+/// Drop a reference to the page of physical memory
+/// pointed at by pa, which normally should have been
+/// returned by a call to kalloc(), and free it when
+/// the last reference is gone. Pages shared
+/// copy-on-write have one reference per page table.
 void kfree(void* pa) {
-  buddy_free(pa);
+  if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfree");
+  if (page_get(pa)->order != 0)
+    panic("kfree: multi-page block");
+
+  int refcnt = page_ref_dec(pa);
+  if (refcnt > 0)
+    return;
+  if (refcnt < 0)
+    panic("kfree: refcnt");
+
+  push_off();
+  struct kmagazine* mag = &kmags[cpuid()];
+  acquire(&mag->lock);
+  if (mag->count == KMAG_SIZE) {
+    mag->count -= KMAG_BATCH;
+    buddy_free_batch(&mag->pages[mag->count], KMAG_BATCH);
+    mag->drains++;
+  }
+  mag->pages[mag->count++] = pa;
+  mag->frees++;
+  release(&mag->lock);
+  pop_off();
+}
+
+/// Allocate a page from this CPU's magazine, refilling it
+/// from the buddy allocator or stealing from other CPUs.
+static void* kmag_alloc(void) {
+  void* pa = 0;
+
+  push_off();
+  int id = cpuid();
+  struct kmagazine* mag = &kmags[id];
+  acquire(&mag->lock);
+  if (mag->count > 0) {
+    mag->hits++;
+  } else {
+    mag->misses++;
+    mag->count = buddy_malloc_batch(PGSIZE, mag->pages, KMAG_BATCH);
+    if (mag->count > 0) {
+      mag->refills++;
+    }
+  }
+  if (mag->count > 0) {
+    pa = mag->pages[--mag->count];
+  }
+  release(&mag->lock);
+
+  if (pa == 0) {
+    pa = kmag_steal(id);
+  }
+  pop_off();
+
+  if (pa) {
+    page_get(pa)->refcnt = 1;
+  }
+
+  return pa;
 }
 
 /// Allocate one 4096-byte page of physical memory.
 /// Returns a pointer that the kernel can use.
 /// Returns 0 if the memory cannot be allocated.
 void* kalloc(void) {
-  return buddy_malloc(PGSIZE);
+  void* pa = kmag_alloc();
+
+  if (pa == 0) {
+    // last resort: a page zeroed ahead of time.
+    acquire(&kzero.lock);
+    if (kzero.count > 0) {
+      pa = kzero.pages[--kzero.count];
+    }
+    release(&kzero.lock);
+  }
+
+  return pa;
+}
+
+/// Allocate one zero-filled 4096-byte page.
+/// Takes a page zeroed ahead of time by an idle CPU
+/// if there is one, and zeroes a fresh page otherwise.
+/// Returns 0 if the memory cannot be allocated.
+void* kalloc_zeroed(void) {
+  void* pa = 0;
+
+  acquire(&kzero.lock);
+  if (kzero.count > 0) {
+    pa = kzero.pages[--kzero.count];
+    kzero.hits++;
+  } else {
+    kzero.misses++;
+  }
+  release(&kzero.lock);
+
+  if (pa == 0 && (pa = kalloc()) != 0) {
+    memset(pa, 0, PGSIZE);
+  }
+  return pa;
+}
+
+/// Zero one page into the pool of kalloc_zeroed().
+/// Called by scheduler() when it has nothing to run.
+/// Returns 1 if a page was added, 0 if the pool is
+/// full or there is no free memory.
+int kzero_refill(void) {
+  if (kzero.count >= KZERO_POOL) {
+    return 0;
+  }
+
+  void* pa = kmag_alloc();
+  if (pa == 0) {
+    return 0;
+  }
+  memset(pa, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if (kzero.count < KZERO_POOL) {
+    kzero.pages[kzero.count++] = pa;
+    pa = 0;
+  }
+  release(&kzero.lock);
+
+  if (pa) {
+    kfree(pa);
+    return 0;
+  }
+  return 1;
+}
+
+/// Allocate 2^order physically contiguous pages.
+/// Single pages come from the per-CPU magazines,
+/// larger blocks straight from the buddy allocator.
+/// Returns 0 if the memory cannot be allocated.
+void* kalloc_pages(int order) {
+  if (order == 0) {
+    return kalloc();
+  }
+  return buddy_malloc((uint64)PGSIZE << order);
+}
+
+/// Free 2^order pages earlier returned by kalloc_pages(order).
+void kfree_pages(void* pa, int order) {
+  if (order == 0) {
+    kfree(pa);
+    return;
+  }
+  if (page_get(pa)->order != order)
+    panic("kfree_pages: order");
+  buddy_free(pa);
+}
+
+/// Turn a block from kalloc_pages() into single pages that
+/// kfree() frees one by one, each holding as many references
+/// as the block did.
+void kalloc_split(void* pa) {
+  if (page_get(pa)->order != 0)
+    buddy_split(pa);
+}
+
+/// Allocate blocks of 2^order pages until the allocator runs
+/// out, then free them all. Returns how many were allocated.
+static int kalloc_probe(int order) {
+  void* head = 0;
+  int count = 0;
+
+  // chain the blocks through their first word.
+  for (void* pa; (pa = kalloc_pages(order)) != 0; count++) {
+    *(void**)pa = head;
+    head = pa;
+  }
+  while (head) {
+    void* next = *(void**)head;
+    kfree_pages(head, order);
+    head = next;
+  }
+  return count;
+}
+
+/// Allocate and free a batch of KMAG_BATCH pages in the
+/// buddy allocator, as magazine refills and drains do,
+/// for the given number of rounds. Returns kilocycles spent.
+static int kalloc_churn(int rounds) {
+  void* pages[KMAG_BATCH];
+  uint64 start = r_cycle();
+
+  for (int i = 0; i < rounds; i++) {
+    int n = buddy_malloc_batch(PGSIZE, pages, KMAG_BATCH);
+    buddy_free_batch(pages, n);
+  }
+  return (int)((r_cycle() - start) / 1000);
+}
+
+/// Serve the memctl system call.
+int memctl(int op, int arg) {
+  switch (op) {
+  case MEMCTL_PROBE:
+    if (arg < 0 || MAX_ORDER < arg)
+      return -1;
+    return kalloc_probe(arg);
+  case MEMCTL_COALESCE:
+    if (arg != 0 && arg != 1)
+      return -1;
+    buddy_set_lazy(arg);
+    return 0;
+  case MEMCTL_CHURN:
+    if (arg < 0)
+      return -1;
+    return kalloc_churn(arg);
+  case MEMCTL_UACCESS:
+    if (arg != 0 && arg != 1)
+      return -1;
+    uaccess_set(arg);
+    return 0;
+  case MEMCTL_ASID:
+    if (arg != 0 && arg != 1)
+      return -1;
+    return uvmasid_set(arg);
+  case MEMCTL_MEGAPAGE:
+    if (arg != 0 && arg != 1)
+      return -1;
+    uvmmega_set(arg);
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+/// Collect allocator statistics for the memstat system call.
+void kmemstat(struct memstat* st) {
+  memset(st, 0, sizeof(*st));
+  buddy_stat(st);
+
+  for (int i = 0; i < NCPU; i++) {
+    struct kmagazine* mag = &kmags[i];
+    acquire(&mag->lock);
+    st->cached_pages += mag->count;
+    st->kallocs += mag->hits + mag->misses;
+    st->kfrees += mag->frees;
+    st->kmag_lock_acquires += mag->lock.nacquire;
+    st->kmag_lock_contended += mag->lock.ncontended;
+    release(&mag->lock);
+  }
+  st->cached_pages += kzero.count;
+}
+
+/// Print per-CPU magazine counters.  For debugging.
+/// Runs when user types ^K on console.
+void kallocdump(void) {
+  printf("\ncpu  cached  hits  misses  refills  drains  steals\n");
+  for (int i = 0; i < NCPU; i++) {
+    struct kmagazine* mag = &kmags[i];
+    if (mag->hits + mag->misses + mag->drains == 0) {
+      continue;
+    }
+    printf(
+        "%d  %d  %d  %d  %d  %d  %d\n",
+        i,
+        mag->count,
+        (int)mag->hits,
+        (int)mag->misses,
+        (int)mag->refills,
+        (int)mag->drains,
+        (int)mag->steals
+    );
+  }
+  printf(
+      "zeroed pool: %d cached, %d hits, %d misses\n",
+      kzero.count,
+      (int)kzero.hits,
+      (int)kzero.misses
+  );
 }
@@ -0,0 +1,34 @@
+#ifndef XV6_KERNEL_MEMCTL_H
+#define XV6_KERNEL_MEMCTL_H
+
+/// Operations of the memctl system call, which lets
+/// user-level tests drive the memory system.
+/// Both the kernel and user programs use this header file.
+
+/// Allocate as many blocks of 2^arg pages as possible, free
+/// them again, and return how many could be allocated.
+#define MEMCTL_PROBE 1
+
+/// Select how the buddy allocator coalesces freed blocks:
+/// arg 0 merges on every free, arg 1 defers merging.
+#define MEMCTL_COALESCE 2
+
+/// Run arg rounds of allocating and freeing a batch of single
+/// pages straight from the buddy allocator, and return the
+/// elapsed time in thousands of cycles.
+#define MEMCTL_CHURN 3
+
+/// Select how copyin/copyout reach user memory: arg 0 walks
+/// the page table in software, arg 1 uses the user window.
+#define MEMCTL_UACCESS 4
+
+/// Run processes with their own address space IDs (arg 1),
+/// or all with ASID 0, flushing the TLB on every switch
+/// between user and kernel (arg 0).
+#define MEMCTL_ASID 5
+
+/// Let heap faults map 2 MiB megapages (arg 1), or only
+/// single pages (arg 0).
+#define MEMCTL_MEGAPAGE 6
+
+#endif // XV6_KERNEL_MEMCTL_H
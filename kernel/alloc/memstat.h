@@ -0,0 +1,44 @@
+#ifndef XV6_KERNEL_MEMSTAT_H
+#define XV6_KERNEL_MEMSTAT_H
+
+/// Physical memory allocator statistics returned by the
+/// memstat system call. Both the kernel and user programs
+/// use this header file.
+
+/// Number of block sizes reported; size k is leaf_size << k.
+#define MEMSTAT_NSIZES 32
+
+struct memstat {
+  uint64 leaf_size;                  // bytes in the smallest buddy block
+  int nsizes;                        // block sizes in use, at most MEMSTAT_NSIZES
+  int free_blocks[MEMSTAT_NSIZES];   // free buddy blocks of each size
+  uint64 free_bytes;                 // free bytes in the buddy allocator
+  uint64 cached_pages;               // free pages held by magazines and the zeroed pool
+  int frag;                          // fragmentation index, in thousandths
+
+  uint64 buddy_allocs;               // blocks handed out by the buddy allocator
+  uint64 buddy_frees;                // blocks given back to the buddy allocator
+  uint64 kallocs;                    // pages handed out by kalloc
+  uint64 kfrees;                     // pages given back by kfree
+
+  uint64 buddy_lock_acquires;        // acquisitions of the buddy lock
+  uint64 buddy_lock_contended;       // ... that had to spin
+  uint64 kmag_lock_acquires;         // acquisitions of the magazine locks
+  uint64 kmag_lock_contended;        // ... that had to spin
+
+  uint64 zero_faults;                // heap pages allocated on first touch
+  uint64 file_faults;                // program pages read on first touch
+  uint64 zero_maps;                  // loads given the shared zero page
+  uint64 mega_maps;                  // heap megapages mapped
+  uint64 mega_splits;                // megapages split into pages
+
+  int swap_slots;                    // pages the swap area can hold
+  int swap_used;                     // ... that hold a page
+  uint64 swap_outs;                  // pages written out to swap
+  uint64 swap_ins;                   // pages read back from swap
+
+  int text_pages;                    // program pages in the text cache
+  uint64 text_hits;                  // faults that mapped a cached page
+};
+
+#endif // XV6_KERNEL_MEMSTAT_H
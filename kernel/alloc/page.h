@@ -0,0 +1,36 @@
+#ifndef XV6_KERNEL_PAGE_H
+#define XV6_KERNEL_PAGE_H
+
+/// Per-page descriptors
+///
+/// The buddy allocator keeps one descriptor for every page
+/// of the memory it manages. Only the descriptor of the first
+/// page of an allocated block is meaningful.
+
+#include "../core/type.h"
+
+/// Largest block order kalloc_pages() is asked for:
+/// 2^MAX_ORDER pages are 4 MiB.
+#define MAX_ORDER 10
+
+/// The page starts an allocated block.
+#define PAGE_ALLOCATED (1 << 0)
+
+struct page {
+  int refcnt;  // number of users of the block
+  uint8 order; // block size is 2^order pages
+  uint8 flags; // PAGE_*
+};
+
+/// Descriptor of the page containing pa.
+struct page* page_get(void* pa);
+
+/// Increment the reference count of the block at pa.
+/// Returns the new count.
+int page_ref_inc(void* pa);
+
+/// Decrement the reference count of the block at pa.
+/// Returns the new count.
+int page_ref_dec(void* pa);
+
+#endif // XV6_KERNEL_PAGE_H
@@ -0,0 +1,203 @@
+#include "kernel/core/type.h"
+#include "kernel/core/param.h"
+#include "kernel/sync/spinlock.h"
+#include "kernel/hardware/riscv.h"
+#include "kernel/defs.h"
+
+#include "buddy.h"
+#include "list.h"
+#include "slab.h"
+
+/// Maximum number of objects on a per-CPU free list.
+#define SLAB_CPU_MAX 16
+
+/// Number of objects moved between a per-CPU
+/// free list and the slabs at once.
+#define SLAB_BATCH (SLAB_CPU_MAX / 2)
+
+/// Number of empty slabs a cache keeps
+/// instead of returning them to the buddy allocator.
+#define SLAB_KEEP_EMPTY 1
+
+#define ROUNDUP(n, sz) (((((n)-1) / (sz)) + 1) * (sz))
+
+/// Header at the beginning of every slab page.
+/// `link` must stay first, see list.h.
+struct slab {
+  struct list link;
+  struct slab_cache* cache;
+  void* free; // free objects of this slab
+  int inuse;
+};
+
+#define SLAB_HEADER ROUNDUP(sizeof(struct slab), 16)
+
+static struct slab* slab_of(void* object) {
+  return (struct slab*)PGROUNDDOWN((uint64)object);
+}
+
+static void* pop(void** head) {
+  void* object = *head;
+  *head = *(void**)object;
+  return object;
+}
+
+static void push(void** head, void* object) {
+  *(void**)object = *head;
+  *head = object;
+}
+
+void slab_cache_init(struct slab_cache* cache, char* name, uint size) {
+  if (size < sizeof(void*)) {
+    size = sizeof(void*);
+  }
+  size = ROUNDUP(size, 8);
+  if (SLAB_HEADER + size > PGSIZE) {
+    panic("slab_cache_init: object too large");
+  }
+
+  initlock(&cache->lock, name);
+  cache->name = name;
+  cache->size = size;
+  cache->perslab = (PGSIZE - SLAB_HEADER) / size;
+  lst_init(&cache->partial);
+  lst_init(&cache->full);
+  lst_init(&cache->empty);
+  cache->nempty = 0;
+  cache->nslabs = 0;
+  for (int i = 0; i < NCPU; i++) {
+    cache->cpu[i].free = 0;
+    cache->cpu[i].count = 0;
+  }
+}
+
+/// Take a page from the buddy allocator and carve it into objects.
+/// Caller must hold cache->lock.
+static struct slab* slab_grow(struct slab_cache* cache) {
+  struct slab* slab = buddy_malloc(PGSIZE);
+  if (slab == 0) {
+    return 0;
+  }
+
+  slab->cache = cache;
+  slab->free = 0;
+  slab->inuse = 0;
+  char* object = (char*)slab + SLAB_HEADER;
+  for (int i = 0; i < cache->perslab; i++, object += cache->size) {
+    push(&slab->free, object);
+  }
+
+  cache->nslabs++;
+  return slab;
+}
+
+/// Move up to SLAB_BATCH objects from the slabs to the CPU list.
+/// Caller must hold cache->lock.
+static void slab_refill(struct slab_cache* cache, struct slab_cpu* cpu) {
+  while (cpu->count < SLAB_BATCH) {
+    struct slab* slab;
+    if (!lst_empty(&cache->partial)) {
+      slab = lst_pop(&cache->partial);
+    } else if (!lst_empty(&cache->empty)) {
+      slab = lst_pop(&cache->empty);
+      cache->nempty--;
+    } else if ((slab = slab_grow(cache)) == 0) {
+      return;
+    }
+
+    while (slab->free && cpu->count < SLAB_BATCH) {
+      push(&cpu->free, pop(&slab->free));
+      slab->inuse++;
+      cpu->count++;
+    }
+
+    lst_push(slab->free ? &cache->partial : &cache->full, slab);
+  }
+}
+
+/// Return up to SLAB_BATCH objects from the CPU list to their slabs.
+/// Caller must hold cache->lock.
+static void slab_drain(struct slab_cache* cache, struct slab_cpu* cpu) {
+  for (int i = 0; i < SLAB_BATCH && cpu->free; i++) {
+    void* object = pop(&cpu->free);
+    cpu->count--;
+
+    struct slab* slab = slab_of(object);
+    lst_remove(&slab->link);
+    push(&slab->free, object);
+    slab->inuse--;
+
+    if (0 < slab->inuse) {
+      lst_push(&cache->partial, slab);
+    } else if (cache->nempty < SLAB_KEEP_EMPTY) {
+      lst_push(&cache->empty, slab);
+      cache->nempty++;
+    } else {
+      cache->nslabs--;
+      buddy_free(slab);
+    }
+  }
+}
+
+void* slab_alloc(struct slab_cache* cache) {
+  push_off();
+  struct slab_cpu* cpu = &cache->cpu[cpuid()];
+  if (cpu->free == 0) {
+    acquire(&cache->lock);
+    slab_refill(cache, cpu);
+    release(&cache->lock);
+  }
+  void* object = 0;
+  if (cpu->free) {
+    object = pop(&cpu->free);
+    cpu->count--;
+  }
+  pop_off();
+  return object;
+}
+
+void slab_free(struct slab_cache* cache, void* object) {
+  push_off();
+  struct slab_cpu* cpu = &cache->cpu[cpuid()];
+  push(&cpu->free, object);
+  cpu->count++;
+  if (SLAB_CPU_MAX < cpu->count) {
+    acquire(&cache->lock);
+    slab_drain(cache, cpu);
+    release(&cache->lock);
+  }
+  pop_off();
+}
+
+static struct slab_cache kmalloc_caches[KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1];
+
+static char* kmalloc_names[] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+
+void kmalloc_init(void) {
+  for (int i = 0; i <= KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT; i++) {
+    slab_cache_init(&kmalloc_caches[i], kmalloc_names[i], 1 << (KMALLOC_MIN_SHIFT + i));
+  }
+}
+
+void* kmalloc(uint64 nbytes) {
+  if (nbytes > (1 << KMALLOC_MAX_SHIFT)) {
+    return buddy_malloc(nbytes);
+  }
+  int i = 0;
+  while ((1 << (KMALLOC_MIN_SHIFT + i)) < nbytes) {
+    i++;
+  }
+  return slab_alloc(&kmalloc_caches[i]);
+}
+
+void kmfree(void* p) {
+  // objects never start a page, the slab header does.
+  if ((uint64)p % PGSIZE == 0) {
+    buddy_free(p);
+    return;
+  }
+  slab_free(slab_of(p)->cache, p);
+}
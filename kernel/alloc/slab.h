@@ -0,0 +1,69 @@
+#ifndef XV6_KERNEL_SLAB_H
+#define XV6_KERNEL_SLAB_H
+
+/// Slab Allocator
+///
+/// An object cache hands out fixed-size kernel objects carved
+/// from page-sized slabs taken from the buddy allocator. Freed
+/// objects first go to a small per-CPU free list, and only
+/// batches of them are returned to their slabs under the cache
+/// lock. Allocation prefers partially full slabs, so that
+/// empty slabs can be given back to the buddy allocator.
+
+#include "../core/type.h"
+#include "../core/param.h"
+#include "../sync/spinlock.h"
+
+#include "list.h"
+
+/// Per-CPU free objects of a cache.
+/// Only touched by its CPU with interrupts off.
+struct slab_cpu {
+  void* free; // singly linked through the first word of an object
+  int count;
+};
+
+struct slab_cache {
+  struct spinlock lock;
+  char* name;
+  uint size;    // object size, rounded up to 8 bytes
+  int perslab;  // objects in a single slab
+
+  // lock must be held when using these:
+  struct list partial; // slabs with both used and free objects
+  struct list full;    // slabs without free objects
+  struct list empty;   // slabs without used objects
+  int nempty;
+  int nslabs;
+
+  struct slab_cpu cpu[NCPU];
+};
+
+/// Initialize a cache of objects of the given size.
+/// The size must fit into a single page.
+void slab_cache_init(struct slab_cache* cache, char* name, uint size);
+
+/// Allocate an object from the cache.
+/// Returns 0 if the memory cannot be allocated.
+void* slab_alloc(struct slab_cache* cache);
+
+/// Return an object, earlier allocated from the same cache.
+void slab_free(struct slab_cache* cache, void* object);
+
+/// Smallest and largest kmalloc size class.
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+
+/// Set up the caches behind kmalloc.
+void kmalloc_init(void);
+
+/// Allocate nbytes from the cache of the next power of two
+/// size, or whole pages from the buddy allocator for requests
+/// larger than the largest size class.
+/// Returns 0 if the memory cannot be allocated.
+void* kmalloc(uint64 nbytes);
+
+/// Free memory earlier allocated with kmalloc.
+void kmfree(void* p);
+
+#endif // XV6_KERNEL_SLAB_H
@@ -103,9 +103,13 @@ int consoleread(int user_dst, uint64 dst, int n) {
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer,
+    // without cons.lock so that the page can be faulted in.
     cbuf = c;
-    if (either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    int r = either_copyout(user_dst, dst, &cbuf, 1);
+    acquire(&cons.lock);
+    if (r == -1)
       break;
 
     dst++;
@@ -135,6 +139,9 @@ void consoleintr(int c) {
   case C('P'): // Print process list.
     procdump();
     break;
+  case C('K'): // Print page allocator counters.
+    kallocdump();
+    break;
   case C('U'): // Kill line.
     while (cons.e != cons.w && cons.buf[(cons.e - 1) % INPUT_BUF_SIZE] != '\n'
     ) {
@@ -1,13 +1,19 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // memory regions per process
+#define NSHM         16  // shared memory segments per system
+#define NTEXT       128  // cached pages of program text
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define USTACK      256  // default user stack limit, in pages
+#define MAXUSTACK 16384  // largest user stack limit, in pages
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
+#define NSWAP        16384 // size of swap area after it, in blocks
 #define MAXPATH      128   // maximum file path name
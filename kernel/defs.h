@@ -5,6 +5,9 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstat;
+struct vma;
+struct shm;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -27,6 +30,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -66,6 +70,43 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kallocdump(void);
+void*           kalloc_zeroed(void);
+int             kzero_refill(void);
+void*           kalloc_pages(int);
+void            kfree_pages(void*, int);
+void            kalloc_split(void*);
+int             memctl(int, int);
+void            kmemstat(struct memstat*);
+
+// shm.c
+void            shminit(void);
+int             shm_get(struct proc*, int, int);
+uint64          shm_attach(struct proc*, int);
+int             shm_detach(struct proc*, uint64);
+void            shm_dup(struct shm*);
+void            shm_put(struct shm*);
+void            shm_exit(struct proc*);
+
+// swap.c
+void            swapinit(int);
+void            swap_dup(uint);
+void            swap_put(uint);
+int             swap_read(uint, char*);
+int             swap_reclaim(void);
+void            swapstat(struct memstat*);
+
+// text.c
+void            textinit(void);
+char*           text_get(struct inode*, uint, uint);
+void            text_add(struct inode*, uint, uint, char*);
+void            text_drop(struct inode*);
+int             text_reclaim(void);
+void            textstat(struct memstat*);
+
+// slab.c
+void*           kmalloc(uint64);
+void            kmfree(void*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -74,6 +115,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -88,6 +130,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -160,6 +203,23 @@ void            uartputc(int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// vma.c
+int             vma_map(struct vma*, uint64, uint64, int, int, struct inode*, uint, uint);
+struct vma*     vma_find(struct vma*, uint64);
+int             vma_overlap(struct vma*, uint64, uint64);
+int             vma_fill(struct vma*, uint64, char*);
+int             vma_zero(struct vma*, uint64);
+char*           vma_cached(struct vma*, uint64);
+void            vma_dup(struct vma*, struct vma*);
+void            vma_release(struct vma*);
+uint64          vma_mmap_base(struct vma*);
+uint64          vma_mmap(struct proc*, uint64, int, int, struct inode*, uint);
+int             vma_munmap(struct proc*, uint64, uint64);
+void            vma_munmap_all(struct proc*);
+void            vma_trim(struct proc*, uint64);
+int             vma_prefault(struct proc*);
+int             vma_fork(struct proc*, struct proc*);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
@@ -170,10 +230,22 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmmapshared(pagetable_t, uint64, void**, int, int);
+void            uaccess_set(int);
+void            uvmmega_set(int);
+void            uvmtouch(uint64, uint64, int);
+uint64          uvmsatp(struct proc*);
+void            uvmflush(struct proc*);
+void            uvmswitch(struct proc*);
+int             uvmasid_set(int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
-void            uvmclear(pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmfault(struct proc*, uint64, int);
+void            uvmstat(struct memstat*);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walknext(pagetable_t, uint64*, uint64, int*);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -11,18 +11,24 @@
 #include "kernel/file/stat.h"
 #include "kernel/process/proc.h"
 
-#include "kernel/alloc/buddy.h"
+#include "kernel/alloc/slab.h"
 #include "kernel/file/file.h"
 
 struct devsw devsw[NDEV];
 
+static struct slab_cache file_cache;
+
 void fileinit(void) {
-  // Do nothing
+  slab_cache_init(&file_cache, "file", sizeof(struct file));
 }
 
 /// Allocate a file structure.
+/// Returns `nullptr` if out of memory.
 struct file* filealloc(void) {
-  struct file* file = buddy_malloc(sizeof(struct file));
+  struct file* file = slab_alloc(&file_cache);
+  if (file == nullptr) {
+    return nullptr;
+  }
 
   file->type = FD_NONE;
   file->ref = 1;
@@ -77,7 +83,7 @@ void fileclose(struct file* file) {
     end_op();
   }
 
-  buddy_free(file);
+  slab_free(&file_cache, file);
 }
 
 /// Get metadata about file f.
@@ -128,6 +134,16 @@ int fileread(struct file* file, uint64 addr, int n) {
   }
 
   if (file->type == FD_INODE) {
+    // a page of addr that must be read from a file cannot
+    // be faulted in under the locks readi() holds; fault the
+    // part the read can fill in first. size and off may be
+    // stale here, a page missed makes the read fail.
+    struct inode* ip = file->ip;
+    if (file->off < ip->size) {
+      uint len = ip->size - file->off;
+      uvmtouch(addr, (uint)n < len ? (uint)n : len, 1);
+    }
+
     ilock(file->ip);
 
     const int count = readi(file->ip, 1, addr, file->off, n);
@@ -183,6 +199,7 @@ int filewrite(struct file* file, uint64 addr, int n) {
         remaining = max;
       }
 
+      uvmtouch(addr + index, remaining, 0);
       begin_op();
       ilock(file->ip);
 
@@ -2,6 +2,7 @@
 #include "kernel/file/fs.h"
 #include "kernel/sync/sleeplock.h"
 #include "kernel/core/type.h"
+#include "kernel/alloc/list.h"
 
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
@@ -25,9 +26,11 @@ struct file {
 
 // in-memory copy of an inode
 struct inode {
+  struct list link;   // itable.live, must stay first
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int textref;        // Program regions mapping it, updated atomically
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -20,6 +20,9 @@
 #include "kernel/file/fs.h"
 #include "kernel/file/buf.h"
 #include "kernel/file/file.h"
+#include "kernel/alloc/bits.h"
+#include "kernel/alloc/list.h"
+#include "kernel/alloc/slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
@@ -58,21 +61,20 @@ static void bzero(int dev, int bno) {
 // Allocate a zeroed disk block.
 // returns 0 if out of disk space.
 static uint balloc(uint dev) {
-  int b, bi, m;
+  int b, bi;
   struct buf* bp;
 
   bp = 0;
   for (b = 0; b < sb.size; b += BPB) {
     bp = bread(dev, BBLOCK(b, sb));
-    for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
-      m = 1 << (bi % 8);
-      if ((bp->data[bi / 8] & m) == 0) { // Is block free?
-        bp->data[bi / 8] |= m;           // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    bits map = {(uint64*)bp->data};
+    bi = bits_find_first_zero(map, min(BPB, sb.size - b));
+    if (b + bi < sb.size && bi < BPB) { // Is block free?
+      bits_set(map, bi);                // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      bzero(dev, b + bi);
+      return b + bi;
     }
     brelse(bp);
   }
@@ -83,14 +85,14 @@ static uint balloc(uint dev) {
 // Free a disk block.
 static void bfree(int dev, uint b) {
   struct buf* bp;
-  int bi, m;
+  int bi;
 
   bp = bread(dev, BBLOCK(b, sb));
+  bits map = {(uint64*)bp->data};
   bi = b % BPB;
-  m = 1 << (bi % 8);
-  if ((bp->data[bi / 8] & m) == 0)
+  if (!bits_is_set(map, bi))
     panic("freeing free block");
-  bp->data[bi / 8] &= ~m;
+  bits_clear(map, bi);
   log_write(bp);
   brelse(bp);
 }
@@ -155,6 +157,10 @@ static void bfree(int dev, uint b) {
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The in-memory inodes are allocated from itable.cache and kept
+// on the itable.live list while ip->ref is positive, so memory
+// follows the number of inodes actually in use.
+//
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
@@ -166,16 +172,14 @@ static void bfree(int dev, uint b) {
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slab_cache cache;
+  struct list live;
 } itable;
 
 void iinit() {
-  int i = 0;
-
   initlock(&itable.lock, "itable");
-  for (i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  slab_cache_init(&itable.cache, "inode", sizeof(struct inode));
+  lst_init(&itable.live);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -189,8 +193,14 @@ struct inode* ialloc(uint dev, short type) {
   struct buf* bp;
   struct dinode* dip;
 
+  bp = 0;
   for (inum = 1; inum < sb.ninodes; inum++) {
-    bp = bread(dev, IBLOCK(inum, sb));
+    // read every inode block once, not once per inode
+    if (bp == 0 || inum % IPB == 0) {
+      if (bp)
+        brelse(bp);
+      bp = bread(dev, IBLOCK(inum, sb));
+    }
     dip = (struct dinode*)bp->data + inum % IPB;
     if (dip->type == 0) { // a free inode
       memset(dip, 0, sizeof(*dip));
@@ -199,8 +209,9 @@ struct inode* ialloc(uint dev, short type) {
       brelse(bp);
       return iget(dev, inum);
     }
-    brelse(bp);
   }
+  if (bp)
+    brelse(bp);
   printf("ialloc: no inodes\n");
   return 0;
 }
@@ -229,31 +240,32 @@ void iupdate(struct inode* ip) {
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode* iget(uint dev, uint inum) {
-  struct inode *ip, *empty;
+  struct inode* ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+  for (struct list* node = itable.live.next; node != &itable.live;
+       node = node->next) {
+    ip = (struct inode*)node;
+    if (ip->dev == dev && ip->inum == inum) {
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if (empty == 0 && ip->ref == 0) // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if (empty == 0)
+  // Allocate a new inode entry.
+  if ((ip = slab_alloc(&itable.cache)) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->textref = 0;
   ip->valid = 0;
+  lst_push(&itable.live, ip);
   release(&itable.lock);
 
   return ip;
@@ -333,6 +345,11 @@ void iput(struct inode* ip) {
   }
 
   ip->ref--;
+  if (ip->ref == 0) {
+    // no in-memory pointers left: recycle the entry.
+    lst_remove(&ip->link);
+    slab_free(&itable.cache, ip);
+  }
   release(&itable.lock);
 }
 
@@ -419,6 +436,7 @@ void itrunc(struct inode* ip) {
 
   ip->size = 0;
   iupdate(ip);
+  text_drop(ip);
 }
 
 // Copy stat information from inode.
@@ -475,6 +493,9 @@ int writei(struct inode* ip, int user_src, uint64 src, uint off, uint n) {
     return -1;
   if (off + n > MAXFILE * BSIZE)
     return -1;
+  // a running program reads its pages in from ip on demand.
+  if (ip->textref > 0)
+    return -1;
 
   for (tot = 0; tot < n; tot += m, off += m, src += m) {
     uint addr = bmap(ip, off / BSIZE);
@@ -492,6 +513,8 @@ int writei(struct inode* ip, int user_src, uint64 src, uint off, uint n) {
 
   if (off > ip->size)
     ip->size = off;
+  if (tot > 0 && ip->type == T_FILE)
+    text_drop(ip);
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
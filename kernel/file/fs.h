@@ -24,6 +24,8 @@ struct superblock {
   uint logstart;   // Block number of first log block
   uint inodestart; // Block number of first inode block
   uint bmapstart;  // Block number of first free map block
+  uint swapstart;  // Block number of first swap block
+  uint nswap;      // Number of swap blocks
 };
 
 #define FSMAGIC 0x10203040
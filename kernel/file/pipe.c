@@ -5,6 +5,7 @@
 #include "kernel/sync/spinlock.h"
 #include "kernel/process/proc.h"
 #include "kernel/sync/sleeplock.h"
+#include "kernel/alloc/slab.h"
 
 #include "fs.h"
 #include "file.h"
@@ -20,6 +21,12 @@ struct pipe {
   int writeopen; // write fd is still open
 };
 
+static struct slab_cache pipe_cache;
+
+void pipeinit(void) {
+  slab_cache_init(&pipe_cache, "pipe", sizeof(struct pipe));
+}
+
 int pipealloc(struct file** rfd, struct file** wfd) {
   struct pipe* pipe = nullptr;
   *rfd = *wfd = nullptr;
@@ -34,7 +41,7 @@ int pipealloc(struct file** rfd, struct file** wfd) {
     goto bad;
   }
 
-  pipe = (struct pipe*)kalloc();
+  pipe = slab_alloc(&pipe_cache);
   if (pipe == nullptr) {
     goto bad;
   }
@@ -60,7 +67,7 @@ int pipealloc(struct file** rfd, struct file** wfd) {
 
 bad:
   if (pipe) {
-    kfree((char*)pipe);
+    slab_free(&pipe_cache, pipe);
   }
   if (*rfd) {
     fileclose(*rfd);
@@ -82,34 +89,41 @@ void pipeclose(struct pipe* pi, int writable) {
   }
   if (pi->readopen == 0 && pi->writeopen == 0) {
     release(&pi->lock);
-    kfree((char*)pi);
+    slab_free(&pipe_cache, pi);
   } else
     release(&pi->lock);
 }
 
+// Copies to and from user memory are done without pi->lock
+// held, a buffer at a time, so that they can fault pages in and
+// a process sleeping on a pipe can be swapped out meanwhile.
+
 int pipewrite(struct pipe* pi, uint64 addr, int n) {
-  int i = 0;
+  int i = 0, m;
   struct proc* pr = myproc();
+  char buf[PIPESIZE];
 
-  acquire(&pi->lock);
   while (i < n) {
-    if (pi->readopen == 0 || killed(pr)) {
-      release(&pi->lock);
-      return -1;
-    }
-    if (pi->nwrite == pi->nread + PIPESIZE) { // DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if (copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    m = n - i < PIPESIZE ? n - i : PIPESIZE;
+    if (copyin(pr->pagetable, buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for (int j = 0; j < m;) {
+      if (pi->readopen == 0 || killed(pr)) {
+        release(&pi->lock);
+        return -1;
+      }
+      if (pi->nwrite == pi->nread + PIPESIZE) { // DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+      }
     }
+    i += m;
+    wakeup(&pi->nread);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
@@ -117,7 +131,7 @@ int pipewrite(struct pipe* pi, uint64 addr, int n) {
 int piperead(struct pipe* pi, uint64 addr, int n) {
   int i;
   struct proc* pr = myproc();
-  char ch;
+  char buf[PIPESIZE];
 
   acquire(&pi->lock);
   while (pi->nread == pi->nwrite && pi->writeopen) { // DOC: pipe-empty
@@ -127,14 +141,16 @@ int piperead(struct pipe* pi, uint64 addr, int n) {
     }
     sleep(&pi->nread, &pi->lock); // DOC: piperead-sleep
   }
-  for (i = 0; i < n; i++) { // DOC: piperead-copy
+  // the pipe holds at most PIPESIZE bytes, so one buffer
+  // takes all a read can get.
+  for (i = 0; i < n && i < PIPESIZE; i++) { // DOC: piperead-copy
     if (pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if (copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    buf[i] = pi->data[pi->nread++ % PIPESIZE];
   }
   wakeup(&pi->nwrite); // DOC: piperead-wakeup
   release(&pi->lock);
+  if (i > 0 && copyout(pr->pagetable, addr, buf, i) == -1)
+    return -1;
   return i;
 }
@@ -51,6 +51,12 @@
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
+// window through which the kernel accesses the user
+// address space below UWIN_SIZE, at UWIN + va.
+// see uwin_enter() in vm.c.
+#define UWIN 0x40000000L
+#define UWIN_SIZE 0x40000000L
+
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
@@ -37,6 +37,7 @@ static inline void w_mepc(uint64 x) {
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -158,6 +159,12 @@ static inline void w_pmpaddr0(uint64 x) {
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+#define SATP_ASID_MASK (0xFFFFL << SATP_ASID_SHIFT)
+
+// tag the translations of pagetable with address space ID asid.
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void w_satp(uint64 x) {
@@ -189,6 +196,8 @@ static inline uint64 r_stval() {
 }
 
 // Machine-mode Counter-Enable
+#define MCOUNTEREN_CY (1L << 0) // cycle
+#define MCOUNTEREN_TM (1L << 1) // time
 static inline void w_mcounteren(uint64 x) {
   asm volatile("csrw mcounteren, %0" : : "r"(x));
 }
@@ -206,6 +215,14 @@ static inline uint64 r_time() {
   return x;
 }
 
+// cycle counter, readable in supervisor mode
+// once start() has set MCOUNTEREN_CY.
+static inline uint64 r_cycle() {
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r"(x));
+  return x;
+}
+
 // enable device interrupts
 static inline void intr_on() {
   w_sstatus(r_sstatus() | SSTATUS_SIE);
@@ -252,6 +269,16 @@ static inline void sfence_vma() {
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void sfence_vma_asid(uint64 asid) {
+  asm volatile("sfence.vma zero, %0" : : "r"(asid));
+}
+
+// flush the TLB entries for one page of one address space.
+static inline void sfence_vma_page(uint64 va, uint64 asid) {
+  asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64* pagetable_t; // 512 PTEs
 
@@ -263,17 +290,28 @@ typedef uint64* pagetable_t; // 512 PTEs
 #define PGROUNDUP(sz) (((sz) + PGSIZE - 1) & ~(PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
+// satp holds the address space ID in bits 44..59.
+#define SATP_ASID_SHIFT 44
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+#define PTE_COW (1L << 8) // copy-on-write, one of the RSW bits
+#define PTE_SWAP (1L << 9) // swapped out, PTE_V clear; the other RSW bit
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
 
 #define PTE2PA(pte) (((pte) >> 10) << 12)
 
+// a swapped-out page keeps its swap slot in place of the page number.
+#define SLOT2PTE(slot) PA2PTE((uint64)(slot) << 12)
+#define PTE2SLOT(pte) (PTE2PA(pte) >> 12)
+
 #define PTE_FLAGS(pte) ((pte)&0x3FF)
 
 // extract the three 9-bit page table indices from a virtual address.
@@ -281,6 +319,14 @@ typedef uint64* pagetable_t; // 512 PTEs
 #define PXSHIFT(level) (PGSHIFT + (9 * (level)))
 #define PX(level, va) ((((uint64)(va)) >> PXSHIFT(level)) & PXMASK)
 
+// bytes mapped by one leaf PTE at a level: a page at level 0,
+// a 2 MiB megapage at level 1, a 1 GiB gigapage at level 2.
+#define LEVELSIZE(level) (1L << PXSHIFT(level))
+
+// a valid PTE with any of R, W, X maps memory; one without
+// points to the next level page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
@@ -0,0 +1,149 @@
+#include "kernel/core/type.h"
+#include "kernel/core/param.h"
+#include "kernel/hardware/riscv.h"
+#include "kernel/sync/spinlock.h"
+#include "kernel/process/proc.h"
+#include "kernel/defs.h"
+
+#include "shm.h"
+#include "vma.h"
+
+static struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void shminit(void) { initlock(&shmtable.lock, "shm"); }
+
+// Look up the segment with key, creating it with size bytes
+// of zeroed memory if there is none. The creator p holds a
+// reference to a new segment until it exits, so that one it
+// never attaches is freed too. Returns the segment id, or -1
+// if size does not match or there is no memory.
+int shm_get(struct proc* p, int key, int size) {
+  struct shm* free;
+  int npages = PGROUNDUP(size) / PGSIZE;
+
+  if (key <= 0 || npages <= 0 || npages > SHM_MAXPAGES)
+    return -1;
+
+  acquire(&shmtable.lock);
+again:
+  free = 0;
+  for (struct shm* s = shmtable.shm; s < &shmtable.shm[NSHM]; s++) {
+    if (s->key == key) {
+      if (s->npages == 0) {
+        // another process is creating or freeing it.
+        sleep(s, &shmtable.lock);
+        goto again;
+      }
+      int id = s->npages == npages ? s - shmtable.shm : -1;
+      release(&shmtable.lock);
+      return id;
+    }
+    if (s->key == 0 && free == 0)
+      free = s;
+  }
+  if (free == 0) {
+    release(&shmtable.lock);
+    return -1;
+  }
+  free->key = key;
+  free->ref = 1;
+  free->npages = 0;
+  release(&shmtable.lock);
+
+  // the slot is ours now; allocate without holding the lock.
+  for (int i = 0; i < npages; i++) {
+    if ((free->pages[i] = kalloc_zeroed()) == 0) {
+      while (--i >= 0)
+        kfree(free->pages[i]);
+      acquire(&shmtable.lock);
+      free->key = 0;
+      wakeup(free);
+      release(&shmtable.lock);
+      return -1;
+    }
+  }
+  acquire(&shmtable.lock);
+  free->npages = npages;
+  wakeup(free);
+  release(&shmtable.lock);
+  p->shmcreated |= 1 << (free - shmtable.shm);
+  return free - shmtable.shm;
+}
+
+// Map segment id into p below its mmap regions.
+// Returns the address, or -1 on failure.
+uint64 shm_attach(struct proc* p, int id) {
+  if (id < 0 || id >= NSHM)
+    return -1;
+  struct shm* s = &shmtable.shm[id];
+
+  acquire(&shmtable.lock);
+  if (s->key == 0 || s->npages == 0) {
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->ref++;
+  release(&shmtable.lock);
+
+  uint64 va = vma_mmap(p, (uint64)s->npages * PGSIZE, PTE_R | PTE_W | PTE_U, VMA_SHARED, 0, 0);
+  if (va == -1) {
+    shm_put(s);
+    return -1;
+  }
+  vma_find(p->vmas, va)->shm = s;
+  if (uvmmapshared(p->pagetable, va, s->pages, s->npages, PTE_R | PTE_W | PTE_U) < 0) {
+    vma_munmap(p, va, (uint64)s->npages * PGSIZE);
+    return -1;
+  }
+  return va;
+}
+
+// Detach the segment mapped at va from p.
+// Returns 0 on success, -1 if no segment is mapped there.
+int shm_detach(struct proc* p, uint64 va) {
+  struct vma* v = vma_find(p->vmas, va);
+  if (v == 0 || v->shm == 0 || v->start != va)
+    return -1;
+  return vma_munmap(p, v->start, v->end - v->start);
+}
+
+// Count one more attachment of s, for fork().
+void shm_dup(struct shm* s) {
+  acquire(&shmtable.lock);
+  s->ref++;
+  release(&shmtable.lock);
+}
+
+// Drop an attachment of s, freeing the segment with the last one.
+void shm_put(struct shm* s) {
+  acquire(&shmtable.lock);
+  if (--s->ref > 0) {
+    release(&shmtable.lock);
+    return;
+  }
+  int npages = s->npages;
+  s->npages = 0;
+  release(&shmtable.lock);
+
+  // pages still mapped elsewhere keep their own references.
+  for (int i = 0; i < npages; i++)
+    kfree(s->pages[i]);
+
+  acquire(&shmtable.lock);
+  s->key = 0;
+  wakeup(s);
+  release(&shmtable.lock);
+}
+
+// Drop the references p holds to the segments it created,
+// on exit.
+void shm_exit(struct proc* p) {
+  for (int i = 0; i < NSHM; i++) {
+    if (p->shmcreated & (1 << i))
+      shm_put(&shmtable.shm[i]);
+  }
+  p->shmcreated = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef XV6_KERNEL_SHM_H
+#define XV6_KERNEL_SHM_H
+
+/// Shared memory segments
+///
+/// A segment is a set of physical pages that processes attach
+/// to their address space with shmat(). The segment holds a
+/// reference to each of its pages, and every page table that
+/// maps them holds one more. The segment itself is counted by
+/// attachments, including those inherited through fork(), and
+/// by its creator until that exits; it goes away with the last.
+
+#include "../core/type.h"
+
+/// Largest segment, in pages.
+#define SHM_MAXPAGES 64
+
+struct shm {
+  int key;    // key given to shmget(), 0 if the slot is unused
+  int ref;    // number of attachments
+  int npages;
+  void* pages[SHM_MAXPAGES];
+};
+
+#endif // XV6_KERNEL_SHM_H
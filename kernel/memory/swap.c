@@ -0,0 +1,256 @@
+// Swap space: an area of the disk after the file system,
+// reserved by mkfs, holding user pages evicted when physical
+// memory runs out.
+//
+// A swapped-out page has a PTE with PTE_V clear and PTE_SWAP
+// set, naming a slot of the swap area in place of the physical
+// page; the other flag bits are kept for when it comes back.
+// Victims are chosen by a clock over the user pages of the
+// processes: a page with PTE_A set gets it cleared and a second
+// chance, one with PTE_A clear is written out.
+
+#include "kernel/core/type.h"
+#include "kernel/core/param.h"
+#include "kernel/hardware/riscv.h"
+#include "kernel/sync/spinlock.h"
+#include "kernel/sync/sleeplock.h"
+#include "kernel/process/proc.h"
+#include "kernel/file/fs.h"
+#include "kernel/file/buf.h"
+#include "kernel/defs.h"
+#include "kernel/alloc/memstat.h"
+#include "kernel/alloc/page.h"
+
+// Disk blocks per page.
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+
+#define NSLOT (NSWAP / SLOTBLOCKS)
+
+// Pages to write out each time memory runs out.
+#define SWAP_BATCH 16
+
+extern struct proc proc[NPROC];
+extern struct superblock sb;
+
+static struct {
+  struct sleeplock lock; // serializes the I/O buffers and the clock
+  struct buf buf[SLOTBLOCKS];
+  int hand;              // clock hand: index of a process
+  uint64 handva;         //   and a user address in it
+
+  struct spinlock reflock;
+  uint dev;
+  uint start;            // first block of the swap area
+  int nslot;             // slots in the swap area
+  int next;              // where to look for a free slot
+  uchar ref[NSLOT];      // PTEs naming each slot
+
+  uint64 nout;           // pages written out
+  uint64 nin;            // pages read back
+} swap;
+
+void swapinit(int dev) {
+  initsleeplock(&swap.lock, "swap");
+  initlock(&swap.reflock, "swapref");
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SLOTBLOCKS;
+  if (swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Whether the caller may sleep for disk I/O: it runs in a
+// process and holds no spinlock.
+static int cansleep(void) {
+  push_off();
+  int ok = mycpu()->noff == 1 && mycpu()->proc != 0;
+  pop_off();
+  return ok;
+}
+
+// Take a free slot, or return -1 if the swap area is full.
+static int slot_alloc(void) {
+  int slot = -1;
+
+  acquire(&swap.reflock);
+  for (int i = 0; i < swap.nslot; i++) {
+    int s = (swap.next + i) % swap.nslot;
+    if (swap.ref[s] == 0) {
+      swap.ref[s] = 1;
+      swap.next = s + 1;
+      slot = s;
+      break;
+    }
+  }
+  release(&swap.reflock);
+  return slot;
+}
+
+// Add a reference to slot, for a PTE copied by fork.
+void swap_dup(uint slot) {
+  acquire(&swap.reflock);
+  swap.ref[slot]++;
+  release(&swap.reflock);
+}
+
+// Drop a reference to slot; the last one frees it.
+void swap_put(uint slot) {
+  acquire(&swap.reflock);
+  if (swap.ref[slot] == 0)
+    panic("swap_put");
+  swap.ref[slot]--;
+  release(&swap.reflock);
+}
+
+// Move a page between memory and slot.
+// Caller must hold swap.lock.
+static void swap_rw(uint slot, char* page, int write) {
+  for (int i = 0; i < SLOTBLOCKS; i++) {
+    struct buf* b = &swap.buf[i];
+    b->dev = swap.dev;
+    b->blockno = swap.start + slot * SLOTBLOCKS + i;
+    if (write)
+      memmove(b->data, page + i * BSIZE, BSIZE);
+    virtio_disk_rw(b, write);
+    if (!write)
+      memmove(page + i * BSIZE, b->data, BSIZE);
+  }
+}
+
+// Read the page in slot into page.
+// Returns 0, or -1 if the caller cannot sleep.
+int swap_read(uint slot, char* page) {
+  if (!cansleep())
+    return -1;
+  acquiresleep(&swap.lock);
+  swap_rw(slot, page, 0);
+  swap.nin++;
+  releasesleep(&swap.lock);
+  return 0;
+}
+
+// May pages of p be swapped out? Not while it runs on another
+// CPU. The kernel copies to and from user memory only without
+// spinlocks held, so it can always swap a page back in.
+// Caller must hold p->lock.
+static int evictable(struct proc* p) {
+  if (p->pagetable == 0)
+    return 0;
+  return p == myproc() || p->state == RUNNABLE || p->state == SLEEPING;
+}
+
+// Advance the clock to the next page to evict in p, clearing
+// PTE_A on the pages it passes over. Returns the PTE, with the
+// address in *va, or 0 at the end of p's memory.
+// Caller must hold p->lock.
+static pte_t* swap_clock(struct proc* p, uint64* va) {
+  pte_t* pte;
+  int aged = 0, level;
+
+  for (; (pte = walknext(p->pagetable, va, p->sz, &level)) != 0; *va += LEVELSIZE(level)) {
+    // megapages stay.
+    if (level != 0)
+      continue;
+    if ((*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+      continue;
+    // pages shared copy-on-write or otherwise stay.
+    if (page_get((void*)PTE2PA(*pte))->refcnt != 1)
+      continue;
+    if ((*pte & PTE_A) == 0)
+      break;
+    *pte &= ~PTE_A;
+    aged = 1;
+  }
+  // let the hardware set PTE_A again on the next access.
+  if (aged)
+    uvmflush(p);
+  return pte;
+}
+
+// Write out one page of p chosen by the clock. Returns 1 if a
+// page was freed, 0 if p has no victim left, -1 if the swap
+// area is full. Caller must hold swap.lock.
+static int swap_out(struct proc* p) {
+  uint64 va = swap.handva, pa;
+  pagetable_t pagetable;
+  pte_t* pte;
+  int pid, slot;
+
+  acquire(&p->lock);
+  if (!evictable(p) || (pte = swap_clock(p, &va)) == 0) {
+    release(&p->lock);
+    return 0;
+  }
+  swap.handva = va + PGSIZE;
+  // a store while the page is written out sets PTE_D again.
+  *pte &= ~PTE_D;
+  uvmflush(p);
+  pa = PTE2PA(*pte);
+  page_ref_inc((void*)pa);
+  pagetable = p->pagetable;
+  pid = p->pid;
+  release(&p->lock);
+
+  if ((slot = slot_alloc()) < 0) {
+    kfree((void*)pa);
+    return -1;
+  }
+  swap_rw(slot, (char*)pa, 1);
+
+  // p may have run, exited or been replaced meanwhile.
+  acquire(&p->lock);
+  if (evictable(p) && p->pid == pid && p->pagetable == pagetable
+      && (pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V)
+      && PTE2PA(*pte) == pa && (*pte & PTE_D) == 0
+      && page_get((void*)pa)->refcnt == 2) {
+    *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    uvmflush(p);
+    release(&p->lock);
+    kfree((void*)pa);
+    kfree((void*)pa);
+    swap.nout++;
+    return 1;
+  }
+  release(&p->lock);
+  swap_put(slot);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Free up to SWAP_BATCH pages of memory by writing user pages
+// out to the swap area. Returns the number of pages freed; 0 if
+// the caller cannot sleep or there is nothing left to evict.
+int swap_reclaim(void) {
+  int freed = 0;
+
+  if (swap.nslot == 0 || !cansleep())
+    return 0;
+
+  acquiresleep(&swap.lock);
+  // two turns of the clock: the first may only clear PTE_A.
+  for (int turns = 0; freed < SWAP_BATCH && turns < 2 * NPROC;) {
+    int r = swap_out(&proc[swap.hand]);
+    if (r < 0)
+      break;
+    if (r == 0) {
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+      turns++;
+    }
+    freed += r;
+  }
+  releasesleep(&swap.lock);
+  return freed;
+}
+
+// Collect swap statistics for the memstat system call.
+void swapstat(struct memstat* st) {
+  acquire(&swap.reflock);
+  st->swap_slots = swap.nslot;
+  for (int i = 0; i < swap.nslot; i++)
+    if (swap.ref[i])
+      st->swap_used++;
+  release(&swap.reflock);
+  st->swap_outs = swap.nout;
+  st->swap_ins = swap.nin;
+}
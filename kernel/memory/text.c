@@ -0,0 +1,129 @@
+// Text cache: pages of program files shared by every process
+// that maps them read-only, so that running the same binary
+// again reads no blocks and takes no memory for its text.
+//
+// A page is named by the file it was read from and the bytes
+// of the file it holds, [off, off+n); the rest of the page is
+// zero. The cache holds one reference to each page, and each
+// process mapping it another. A write to the file drops its
+// pages from the cache; processes already mapping one keep it.
+
+#include "kernel/core/type.h"
+#include "kernel/core/param.h"
+#include "kernel/hardware/riscv.h"
+#include "kernel/sync/spinlock.h"
+#include "kernel/sync/sleeplock.h"
+#include "kernel/file/fs.h"
+#include "kernel/file/file.h"
+#include "kernel/defs.h"
+#include "kernel/alloc/memstat.h"
+#include "kernel/alloc/page.h"
+
+struct textpage {
+  uint dev;    // file the page was read from
+  uint inum;
+  uint off;    // file offset of the page
+  uint n;      // bytes of the file it holds
+  char* page;  // 0 if the entry is free
+};
+
+static struct {
+  struct spinlock lock;
+  struct textpage pages[NTEXT];
+  int hand;     // where to look for an entry to replace
+  uint64 hits;  // faults served from the cache
+} text;
+
+void textinit(void) { initlock(&text.lock, "text"); }
+
+// Return the cached page of ip holding [off, off+n) with a
+// reference for the caller, or 0 if it is not cached.
+char* text_get(struct inode* ip, uint off, uint n) {
+  char* page = 0;
+
+  acquire(&text.lock);
+  for (struct textpage* t = text.pages; t < &text.pages[NTEXT]; t++) {
+    if (t->page && t->dev == ip->dev && t->inum == ip->inum && t->off == off && t->n == n) {
+      page = t->page;
+      page_ref_inc(page);
+      text.hits++;
+      break;
+    }
+  }
+  release(&text.lock);
+  return page;
+}
+
+// Add page, just read from ip, to the cache. Replaces a page
+// no process maps any more if the cache is full, and gives up
+// if there is none. Caller must hold ip->lock, so that a write
+// to ip cannot come between reading the page and adding it.
+void text_add(struct inode* ip, uint off, uint n, char* page) {
+  struct textpage* t = 0;
+
+  acquire(&text.lock);
+  for (int i = 0; i < NTEXT; i++) {
+    struct textpage* u = &text.pages[(text.hand + i) % NTEXT];
+    if (u->page && u->dev == ip->dev && u->inum == ip->inum && u->off == off && u->n == n) {
+      // another process read the page meanwhile.
+      release(&text.lock);
+      return;
+    }
+    if (t == 0 && (u->page == 0 || page_get(u->page)->refcnt == 1))
+      t = u;
+  }
+  if (t == 0) {
+    release(&text.lock);
+    return;
+  }
+  text.hand = (t - text.pages + 1) % NTEXT;
+  if (t->page)
+    kfree(t->page);
+  t->dev = ip->dev;
+  t->inum = ip->inum;
+  t->off = off;
+  t->n = n;
+  t->page = page;
+  page_ref_inc(page);
+  release(&text.lock);
+}
+
+// Forget the cached pages of ip, whose contents change.
+// Caller must hold ip->lock.
+void text_drop(struct inode* ip) {
+  acquire(&text.lock);
+  for (struct textpage* t = text.pages; t < &text.pages[NTEXT]; t++) {
+    if (t->page && t->dev == ip->dev && t->inum == ip->inum) {
+      kfree(t->page);
+      t->page = 0;
+    }
+  }
+  release(&text.lock);
+}
+
+// Free the cached pages that no process maps, when memory
+// runs out. Returns the number of pages freed.
+int text_reclaim(void) {
+  int freed = 0;
+
+  acquire(&text.lock);
+  for (struct textpage* t = text.pages; t < &text.pages[NTEXT]; t++) {
+    if (t->page && page_get(t->page)->refcnt == 1) {
+      kfree(t->page);
+      t->page = 0;
+      freed++;
+    }
+  }
+  release(&text.lock);
+  return freed;
+}
+
+// Collect text cache statistics for the memstat system call.
+void textstat(struct memstat* st) {
+  acquire(&text.lock);
+  for (struct textpage* t = text.pages; t < &text.pages[NTEXT]; t++)
+    if (t->page)
+      st->text_pages++;
+  st->text_hits = text.hits;
+  release(&text.lock);
+}
@@ -3,8 +3,12 @@
 #include "kernel/hardware/memlayout.h"
 #include "kernel/process/elf.h"
 #include "kernel/hardware/riscv.h"
+#include "kernel/sync/spinlock.h"
+#include "kernel/process/proc.h"
 #include "kernel/defs.h"
 #include "kernel/file/fs.h"
+#include "kernel/alloc/page.h"
+#include "kernel/alloc/memstat.h"
 
 /*
  * the kernel's page table.
@@ -15,12 +19,53 @@ extern char etext[]; // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Number of user pages allocated on first touch.
+static uint64 nzerofault;
+static uint64 nfilefault;
+static uint64 nzeromap; // reads given the zero page instead
+static uint64 nmega;    // heap megapages mapped
+static uint64 nsplit;   // megapages split into single pages
+
+// A megapage maps 2 MiB of the heap with one level-1 PTE,
+// backed by a block of 2^MEGAORDER pages.
+#define MEGASIZE LEVELSIZE(1)
+#define MEGAORDER 9
+
+// Whether heap faults may map megapages.
+static int mega_on = 1;
+
+// Serializes megapage block references with splits, see megaref().
+static struct spinlock megalock;
+
+// A page of zeros that is mapped read-only, copy-on-write,
+// wherever a process reads memory it has not written yet.
+// It holds one reference of its own, so that uvmcow()
+// always copies it and kfree() never frees it.
+static char* zeropage;
+
+// Whether copyin/copyout go through the user window.
+static int uaccess_direct = 1;
+
+// Largest ASID the hardware supports, and whether processes
+// run with their own ASIDs instead of sharing the kernel's
+// ASID 0. Without them trampoline.S flushes the whole TLB on
+// every switch between user and kernel page tables.
+static uint64 asid_max;
+static int asid_on;
+
+// Bumped when asid_on changes; a CPU that has not seen the
+// new value may hold entries under any ASID, see uvmswitch().
+static int asidgen;
+
+// uaccess.S
+int uaccess_copy(char* dst, char* src, uint64 n);
+int uaccess_copystr(char* dst, char* src, uint64 max);
+
 // Make a direct-map page table for the kernel.
 pagetable_t kvmmake(void) {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t)kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t)kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -53,19 +98,161 @@ pagetable_t kvmmake(void) {
   return kpgtbl;
 }
 
+// Count the page-table pages of pagetable, itself included.
+static int kvmcount(pagetable_t pagetable) {
+  int n = 1;
+  for (int i = 0; i < 512; i++) {
+    pte_t pte = pagetable[i];
+    if ((pte & PTE_V) && !PTE_LEAF(pte))
+      n += kvmcount((pagetable_t)PTE2PA(pte));
+  }
+  return n;
+}
+
 // Initialize the one kernel_pagetable
-void kvminit(void) { kernel_pagetable = kvmmake(); }
+void kvminit(void) {
+  uint64 start = r_cycle();
+
+  kernel_pagetable = kvmmake();
+  if ((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zeropage");
+  initlock(&megalock, "mega");
 
-// Switch h/w page table register to the kernel's page table,
-// and enable paging.
+  printf(
+      "kvminit: %d page-table pages, %d kcycles\n",
+      kvmcount(kernel_pagetable),
+      (int)((r_cycle() - start) / 1000)
+  );
+}
+
+// Switch h/w page table register to this hart's copy of the
+// kernel's page table, and enable paging. Each hart has its
+// own root page so that it can map the user window.
 void kvminithart() {
+  struct cpu* c = mycpu();
+
+  if (c->kpagetable == 0) {
+    if ((c->kpagetable = (pagetable_t)kalloc()) == 0)
+      panic("kvminithart");
+    memmove(c->kpagetable, kernel_pagetable, PGSIZE);
+  }
+
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(c->kpagetable));
 
   // flush stale entries from the TLB.
   sfence_vma();
+
+  if (cpuid() == 0) {
+    // the ASID bits the hardware lacks read back as zero.
+    w_satp(MAKE_SATP(c->kpagetable) | SATP_ASID_MASK);
+    asid_max = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+    w_satp(MAKE_SATP(c->kpagetable));
+    sfence_vma();
+    asid_on = asid_max >= NPROC;
+    printf("kvminithart: %d ASIDs%s\n", (int)asid_max + 1, asid_on ? "" : ", not used");
+  }
+}
+
+// The satp value that runs p with its page table.
+// A CPU that kept running p while asid_on changed never went
+// through uvmswitch() and may hold entries tagged under the
+// old scheme; it drops them all before returning to user
+// space, so that every CPU flushes once after the change.
+// Called by usertrapret() with interrupts off.
+uint64 uvmsatp(struct proc* p) {
+  struct cpu* c = mycpu();
+
+  if (c->asidgen != asidgen) {
+    c->asidgen = asidgen;
+    sfence_vma();
+  }
+  return MAKE_SATP_ASID(p->pagetable, asid_on ? p->asid : 0);
+}
+
+// Drop the TLB entries of p's address space after its page
+// table changed: on this CPU now if p is running here, and on
+// every other CPU before p next runs there, see uvmswitch().
+// Copies of them made through the user window go as well.
+void uvmflush(struct proc* p) {
+  push_off();
+  uint self = 1 << cpuid();
+  if (myproc() == p) {
+    __sync_fetch_and_or(&p->tlbstale, ~self);
+    sfence_vma_asid(asid_on ? p->asid : 0);
+    sfence_vma_asid(0);
+  } else {
+    __sync_fetch_and_or(&p->tlbstale, ~0u);
+  }
+  pop_off();
+}
+
+// uvmflush() for the process whose page table is pagetable,
+// if it is the current one. Page tables of other processes
+// only change while being built or torn down, and their
+// ASID is flushed when the slot is allocated again.
+static void uvmflush_pt(pagetable_t pagetable) {
+  struct proc* p = myproc();
+  if (p != 0 && p->pagetable == pagetable)
+    uvmflush(p);
+}
+
+// Prepare this CPU's TLB for running p.
+// Called by scheduler() with p->lock held.
+void uvmswitch(struct proc* p) {
+  struct cpu* c = mycpu();
+  uint self = 1 << cpuid();
+
+  if (c->asidgen != asidgen) {
+    c->asidgen = asidgen;
+    sfence_vma();
+  } else if (p->tlbstale & self) {
+    sfence_vma_asid(asid_on ? p->asid : 0);
+  }
+  __sync_fetch_and_and(&p->tlbstale, ~self);
+
+  // the window is set up again on first use.
+  c->uwin = 0;
+}
+
+// Run processes with their own ASIDs (1), or all with ASID 0
+// and a full TLB flush on every switch (0), for benchmarks.
+// Every CPU flushes its whole TLB before it next runs user
+// code, see uvmswitch() and uvmsatp().
+// Returns -1 if the hardware has too few ASIDs.
+int uvmasid_set(int on) {
+  if (on && asid_max < NPROC)
+    return -1;
+  if (on != asid_on) {
+    asid_on = on;
+    __sync_fetch_and_add(&asidgen, 1);
+    sfence_vma();
+  }
+  return 0;
+}
+
+// Like walk() below, but return the PTE at the given level, which
+// maps a superpage if it is a leaf. Returns 0 if va lies in
+// a superpage mapped above that level.
+static pte_t* walklevel(pagetable_t pagetable, uint64 va, int level, int alloc) {
+  if (va >= MAXVA)
+    panic("walk");
+
+  for (int l = 2; l > level; l--) {
+    pte_t* pte = &pagetable[PX(l, va)];
+    if (*pte & PTE_V) {
+      if (PTE_LEAF(*pte))
+        return 0;
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if (!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+        return 0;
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(level, va)];
 }
 
 // Return the address of the PTE in page table pagetable
@@ -81,21 +268,65 @@ void kvminithart() {
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t* walk(pagetable_t pagetable, uint64 va, int alloc) {
-  if (va >= MAXVA)
-    panic("walk");
+  return walklevel(pagetable, va, 0, alloc);
+}
 
-  for (int level = 2; level > 0; level--) {
-    pte_t* pte = &pagetable[PX(level, va)];
-    if (*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if (!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
+
+// Find the first PTE that maps or swaps out a page at or above
+// *va and below end, set *va to that page's address, and return
+// the PTE. Skips whole unmapped level-2 and level-1 ranges, so
+// that walking a sparse address space costs about as much as
+// the pages mapped in it. Returns 0 if there is no such PTE.
+// Sets *level to 0, or to 1 for the level-1 PTE of a megapage,
+// whose first address *va may then lie below where the walk
+// started. Callers that know there are no megapages in the
+// range may pass a null level.
+pte_t* walknext(pagetable_t pagetable, uint64* va, uint64 end, int* level) {
+  uint64 a = *va;
+
+  while (a < end && a < MAXVA) {
+    pagetable_t pt = pagetable;
+    int l;
+    for (l = 2; l > 0; l--) {
+      pte_t pte = pt[PX(l, a)];
+      if ((pte & PTE_V) == 0 || PTE_LEAF(pte))
+        break;
+      pt = (pagetable_t)PTE2PA(pte);
+    }
+    if (l > 0 && (pt[PX(l, a)] & PTE_V)) {
+      if (l != 1 || level == 0)
+        panic("walknext: superpage");
+      *va = a & ~(MEGASIZE - 1);
+      *level = 1;
+      return &pt[PX(1, a)];
+    }
+    if (l > 0) {
+      // nothing mapped up to the next level-sized boundary.
+      a = (a | (LEVELSIZE(l) - 1)) + 1;
+      continue;
+    }
+    if (pt[PX(0, a)] & (PTE_V | PTE_SWAP)) {
+      *va = a;
+      if (level)
+        *level = 0;
+      return &pt[PX(0, a)];
     }
+    a += PGSIZE;
   }
-  return &pagetable[PX(0, va)];
+  return 0;
+}
+
+// Return the leaf PTE that maps va: the level-1 PTE if va lies
+// in a megapage, setting *level to 1, and otherwise the level-0
+// PTE as walk() does, setting *level to 0.
+static pte_t* walkleaf(pagetable_t pagetable, uint64 va, int* level) {
+  pte_t* pte = walklevel(pagetable, va, 1, 0);
+  if (pte != 0 && (*pte & PTE_V) && PTE_LEAF(*pte)) {
+    *level = 1;
+    return pte;
+  }
+  *level = 0;
+  return walk(pagetable, va, 0);
 }
 
 // Look up a virtual address, return the physical address,
@@ -104,11 +335,12 @@ pte_t* walk(pagetable_t pagetable, uint64 va, int alloc) {
 uint64 walkaddr(pagetable_t pagetable, uint64 va) {
   pte_t* pte;
   uint64 pa;
+  int level;
 
   if (va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &level);
   if (pte == 0)
     return 0;
   if ((*pte & PTE_V) == 0)
@@ -116,15 +348,34 @@ uint64 walkaddr(pagetable_t pagetable, uint64 va) {
   if ((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if (level == 1)
+    pa += PGROUNDDOWN(va % MEGASIZE);
   return pa;
 }
 
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// maps with the largest pages that va, pa and the remaining
+// size are aligned to, so that the direct map of RAM takes
+// few page-table pages and TLB entries.
 void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm) {
-  if (mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 end = PGROUNDUP(va + sz);
+
+  for (va = PGROUNDDOWN(va); va < end;) {
+    int level = 2;
+    while (level > 0
+           && ((va | pa) % LEVELSIZE(level) != 0 || end - va < LEVELSIZE(level)))
+      level--;
+    pte_t* pte = walklevel(kpgtbl, va, level, 1);
+    if (pte == 0)
+      panic("kvmmap");
+    if (*pte & PTE_V)
+      panic("kvmmap: remap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    va += LEVELSIZE(level);
+    pa += LEVELSIZE(level);
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -156,21 +407,85 @@ int mappages(
   return 0;
 }
 
+// Take (inc) or drop a reference to the block of a megapage
+// at pa, freeing it with the last one. Once some page table
+// split its mapping of the block, the block is single pages
+// and each page counts the references on its own.
+static void megaref(uint64 pa, int inc) {
+  acquire(&megalock);
+  if (page_get((void*)pa)->order == MEGAORDER) {
+    if (inc)
+      page_ref_inc((void*)pa);
+    else if (page_ref_dec((void*)pa) == 0)
+      kfree_pages((void*)pa, MEGAORDER);
+  } else {
+    for (uint64 a = pa; a < pa + MEGASIZE; a += PGSIZE) {
+      if (inc)
+        page_ref_inc((void*)a);
+      else
+        kfree((void*)a);
+    }
+  }
+  release(&megalock);
+}
+
+// Replace the megapage mapped by the level-1 PTE pte with a
+// page-table page mapping the same pages with the same flags,
+// so that they can be unmapped or copied one by one.
+// Returns 0, or -1 if there is no memory for the table.
+static int uvmsplit(pagetable_t pagetable, pte_t* pte) {
+  pagetable_t pt;
+
+  if ((pt = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+  uint64 pa = PTE2PA(*pte);
+  uint flags = PTE_FLAGS(*pte);
+  acquire(&megalock);
+  kalloc_split((void*)pa);
+  release(&megalock);
+  for (int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + (uint64)i * PGSIZE) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  uvmflush_pt(pagetable);
+  __sync_fetch_and_add(&nsplit, 1);
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages of the heap that were never touched
+// have no mapping and are skipped. A megapage only partly
+// in the range is split first.
 // Optionally free the physical memory.
 void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
-  uint64 a;
+  uint64 a, end;
   pte_t* pte;
+  int level;
 
   if ((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
-    if ((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if ((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+  end = va + npages * PGSIZE;
+  for (a = va; (pte = walknext(pagetable, &a, end, &level)) != 0; a += LEVELSIZE(level)) {
+    if (level == 1) {
+      if (a >= va && a + MEGASIZE <= end) {
+        if (do_free)
+          megaref(PTE2PA(*pte), 0);
+        *pte = 0;
+        continue;
+      }
+      if (uvmsplit(pagetable, pte) != 0)
+        panic("uvmunmap: split");
+      if (a < va)
+        a = va;
+      pte = walk(pagetable, a, 0);
+      level = 0;
+    }
+    if (*pte & PTE_SWAP) {
+      if (do_free)
+        swap_put(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if (PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if (do_free) {
@@ -179,16 +494,16 @@ void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
     }
     *pte = 0;
   }
+  uvmflush_pt(pagetable);
 }
 
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t uvmcreate() {
   pagetable_t pagetable;
-  pagetable = (pagetable_t)kalloc();
+  pagetable = (pagetable_t)kalloc_zeroed();
   if (pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -200,12 +515,25 @@ void uvmfirst(pagetable_t pagetable, uchar* src, uint sz) {
 
   if (sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W | PTE_R | PTE_X | PTE_U);
   memmove(mem, src, sz);
 }
 
+// Allocate a page of user memory, zeroed if zeroed is set.
+// When memory has run out, drop text cache pages no one maps
+// and write other user pages out to the swap area to make
+// room, if the caller can sleep.
+static void* uvmkalloc(int zeroed) {
+  void* mem;
+
+  do {
+    if ((mem = zeroed ? kalloc_zeroed() : kalloc()) != 0)
+      return mem;
+  } while (text_reclaim() > 0 || swap_reclaim() > 0);
+  return 0;
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
@@ -217,12 +545,11 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
 
   oldsz = PGROUNDUP(oldsz);
   for (a = oldsz; a < newsz; a += PGSIZE) {
-    mem = kalloc();
+    mem = uvmkalloc(1);
     if (mem == 0) {
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R | PTE_U | xperm)
         != 0) {
       kfree(mem);
@@ -236,11 +563,21 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if a
+// megapage could not be split.
 uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
   if (newsz >= oldsz)
     return oldsz;
 
+  // split a megapage that is cut in two here, so that a lack
+  // of memory for the split shows up as a failure to shrink.
+  int level;
+  pte_t* pte;
+  if (PGROUNDUP(newsz) % MEGASIZE != 0
+      && (pte = walkleaf(pagetable, PGROUNDUP(newsz), &level)) != 0 && level == 1
+      && uvmsplit(pagetable, pte) != 0)
+    return oldsz;
+
   if (PGROUNDUP(newsz) < PGROUNDUP(oldsz)) {
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
@@ -275,49 +612,377 @@ void uvmfree(pagetable_t pagetable, uint64 sz) {
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Copies the page table only: writable pages
+// become read-only copy-on-write pages in both
+// page tables, see uvmcow().
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
+  return uvmshare(old, new, 0, sz, 1);
+}
+
+// Map the pages of [start, end) of old into new as well.
+// With cow, writable pages become copy-on-write in both
+// page tables; otherwise both can store to the same pages.
+// returns 0 on success, -1 on failure.
+// frees any allocated pages on failure.
+int uvmshare(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int cow) {
   pte_t* pte;
   uint64 pa, i;
   uint flags;
-  char* mem;
+  int level;
 
-  for (i = 0; i < sz; i += PGSIZE) {
-    if ((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if ((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  // pages not touched yet are skipped; the child faults them in too.
+  for (i = start; (pte = walknext(old, &i, end, &level)) != 0; i += LEVELSIZE(level)) {
+    if (level == 1) {
+      // the child shares the megapage, copy-on-write as well.
+      pte_t* npte = walklevel(new, i, 1, 1);
+      if (npte == 0 || (*npte & PTE_V))
+        goto err;
+      if (cow && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      *npte = *pte & ~(PTE_A | PTE_D);
+      megaref(PTE2PA(*pte), 1);
+      continue;
+    }
+    if (*pte & PTE_SWAP) {
+      // the child shares the copy in the swap area.
+      pte_t* npte = walk(new, i, 1);
+      if (npte == 0)
+        goto err;
+      *npte = *pte;
+      swap_dup(PTE2SLOT(*pte));
+      continue;
+    }
     pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if ((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if (mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-      kfree(mem);
-      goto err;
+    if (cow && (*pte & PTE_W)) {
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     }
+    flags = PTE_FLAGS(*pte) & ~(PTE_A | PTE_D);
+    if (mappages(new, i, PGSIZE, pa, flags) != 0)
+      goto err;
+    page_ref_inc((void*)pa);
   }
+  // the parent's pages are no longer writable.
+  uvmflush_pt(old);
   return 0;
 
 err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
-// mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
-void uvmclear(pagetable_t pagetable, uint64 va) {
+// Map the physical pages pages[0..npages) at va, which
+// must be page-aligned, taking a reference to each page.
+// Returns 0 on success, -1 with nothing mapped on failure.
+int uvmmapshared(pagetable_t pagetable, uint64 va, void** pages, int npages, int perm) {
+  for (int i = 0; i < npages; i++) {
+    if (mappages(pagetable, va + (uint64)i * PGSIZE, PGSIZE, (uint64)pages[i], perm) != 0) {
+      uvmunmap(pagetable, va, i, 1);
+      return -1;
+    }
+    page_ref_inc(pages[i]);
+  }
+  return 0;
+}
+
+// Give the copy-on-write page at va a private writable copy.
+// If no one else shares the page any more, it is just made
+// writable again. A shared megapage is split, and only the
+// page at va copied. Returns 0 on success, -1 if va is not a
+// copy-on-write user page or there is no memory for the copy.
+int uvmcow(pagetable_t pagetable, uint64 va) {
   pte_t* pte;
+  uint64 pa;
+  uint flags;
+  char* mem;
+  int level;
 
-  pte = walk(pagetable, va, 0);
+  if (va >= MAXVA)
+    return -1;
+  pte = walkleaf(pagetable, va, &level);
   if (pte == 0)
-    panic("uvmclear");
-  *pte &= ~PTE_U;
+    return -1;
+  if ((*pte & (PTE_V | PTE_U | PTE_COW)) != (PTE_V | PTE_U | PTE_COW))
+    return -1;
+
+  if (level == 1) {
+    pa = PTE2PA(*pte);
+    struct page* page = page_get((void*)pa);
+    if (page->order == MEGAORDER && page->refcnt == 1) {
+      *pte = (*pte & ~PTE_COW) | PTE_W;
+      uvmflush_pt(pagetable);
+      return 0;
+    }
+    if (uvmsplit(pagetable, pte) != 0)
+      return -1;
+    pte = walk(pagetable, va, 0);
+  }
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if ((char*)pa == zeropage) {
+    // the first store to memory that was only read.
+    if ((mem = uvmkalloc(1)) == 0)
+      return -1;
+    *pte = PA2PTE(mem) | flags;
+    kfree((void*)pa);
+    uvmflush_pt(pagetable);
+    __sync_fetch_and_add(&nzerofault, 1);
+    return 0;
+  }
+  if (page_get((void*)pa)->refcnt == 1) {
+    *pte = PA2PTE(pa) | flags;
+    uvmflush_pt(pagetable);
+    return 0;
+  }
+
+  if ((mem = uvmkalloc(0)) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  uvmflush_pt(pagetable);
+  return 0;
+}
+
+// Read the swapped-out page of the current process with
+// PTE pte back into memory. Returns 0, or -1 if there is no
+// memory or the caller cannot sleep.
+static int uvmswapin(pte_t* pte) {
+  char* mem;
+
+  if ((mem = uvmkalloc(0)) == 0)
+    return -1;
+  uint slot = PTE2SLOT(*pte);
+  if (swap_read(slot, mem) != 0) {
+    kfree(mem);
+    return -1;
+  }
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  swap_put(slot);
+  return 0;
+}
+
+// Back the 2 MiB-aligned part of p's heap around va with a
+// megapage, if all of it lies in the heap, none of it is
+// mapped yet and the buddy allocator has a free block of
+// that size. Returns 0 on success, -1 to fall back to pages.
+static int uvmmega(struct proc* p, uint64 va) {
+  uint64 base = va & ~(MEGASIZE - 1);
+  pagetable_t pt = 0;
+  pte_t* pte;
+  char* mem;
+
+  if (!mega_on || base + MEGASIZE > p->sz || vma_overlap(p->vmas, base, base + MEGASIZE))
+    return -1;
+  if ((pte = walklevel(p->pagetable, base, 1, 1)) == 0)
+    return -1;
+  if (*pte & PTE_V) {
+    // a page-table page that earlier unmaps left empty may go.
+    pt = (pagetable_t)PTE2PA(*pte);
+    for (int i = 0; i < 512; i++)
+      if (pt[i] != 0)
+        return -1;
+  }
+
+  if ((mem = kalloc_pages(MEGAORDER)) == 0)
+    return -1;
+  memset(mem, 0, MEGASIZE);
+  *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+  uvmflush(p);
+  if (pt)
+    kfree(pt);
+  __sync_fetch_and_add(&nmega, 1);
+  return 0;
+}
+
+// Handle a page fault of process p at va.
+// A page of one of p's regions is filled from its file
+// or zeroed, a swapped-out page is read back in,
+// any other page below p->sz without a mapping is heap
+// reserved by sbrk() and gets a zeroed page; a store to
+// a copy-on-write page gets a private copy. A load from
+// a page that would be all zeros maps the shared zero
+// page until the first store, and a page of program text
+// that another process already read maps the same page.
+// A store to the heap maps a whole megapage where it can.
+// access is PTE_R for a load, PTE_W for a store and PTE_X
+// for an instruction fetch, which the page must permit.
+// Returns 0 if the access can be retried, -1 if it is a
+// genuine fault.
+int uvmfault(struct proc* p, uint64 va, int access) {
+  pagetable_t pagetable = p->pagetable;
+  struct vma* v;
+  pte_t* pte;
+  char* mem;
+  int perm = PTE_R | PTE_W | PTE_U;
+  int level;
+
+  if (va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkleaf(pagetable, va, &level);
+  if (pte != 0 && (*pte & PTE_V)) {
+    // the TLB may still hold the PTE as it was before the
+    // page was mapped or made writable; flush it and retry.
+    if ((*pte & PTE_U) && (*pte & access)) {
+      sfence_vma_page(va, asid_on ? p->asid : 0);
+      return 0;
+    }
+    return access == PTE_W ? uvmcow(pagetable, va) : -1;
+  }
+  if (pte != 0 && (*pte & PTE_SWAP))
+    return uvmswapin(pte);
+  // only mmap regions lie above p->sz; a program region
+  // that sbrk() shrank below must not come back.
+  v = vma_find(p->vmas, va);
+  if (va >= p->sz && (v == 0 || (v->flags & VMA_MMAP) == 0))
+    return -1;
+
+  if (v != 0)
+    perm = v->perm;
+  if ((perm & access) == 0)
+    return -1;
+
+  if (access != PTE_W && (v == 0 || vma_zero(v, va))) {
+    if (perm & PTE_W)
+      perm = (perm & ~PTE_W) | PTE_COW;
+    if (mappages(pagetable, va, PGSIZE, (uint64)zeropage, perm) != 0)
+      return -1;
+    page_ref_inc(zeropage);
+    __sync_fetch_and_add(&nzeromap, 1);
+    return 0;
+  }
+
+  if (v == 0 && uvmmega(p, va) == 0)
+    return 0;
+
+  if (v != 0 && (mem = vma_cached(v, va)) != 0) {
+    if (mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0) {
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+
+  if ((mem = uvmkalloc(1)) == 0)
+    return -1;
+  if ((v != 0 && vma_fill(v, va, mem) != 0)
+      || mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0) {
+    kfree(mem);
+    return -1;
+  }
+  __sync_fetch_and_add(v ? &nfilefault : &nzerofault, 1);
+  return 0;
+}
+
+// Fault in the pages of the current process that hold
+// [va, va+len), so that copies done with locks held that
+// a read from a file may need find them present.
+void uvmtouch(uint64 va, uint64 len, int write) {
+  struct proc* p = myproc();
+
+  for (uint64 a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE) {
+    int level;
+    pte_t* pte = walkleaf(p->pagetable, a, &level);
+    if (pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW)))
+      uvmfault(p, a, write ? PTE_W : PTE_R);
+  }
+}
+
+// Fill in the virtual memory counters of st.
+void uvmstat(struct memstat* st) {
+  st->zero_faults = nzerofault;
+  st->file_faults = nfilefault;
+  st->zero_maps = nzeromap;
+  st->mega_maps = nmega;
+  st->mega_splits = nsplit;
+}
+
+// Physical address of the user page at va0, for copying
+// to (write) or from it. Faults in heap pages of the current
+// process that were not touched yet, and breaks copy-on-write
+// sharing before a write, marking the page dirty. Returns 0
+// if va0 is not accessible, or not writable for a write: the
+// shared zero page and text pages must never be written.
+static uint64 useraddr(pagetable_t pagetable, uint64 va0, int write) {
+  struct proc* p = myproc();
+  pte_t* pte;
+  int level;
+
+  if (va0 >= MAXVA)
+    return 0;
+  pte = walkleaf(pagetable, va0, &level);
+  // a page swapped in may still be copy-on-write, and need a
+  // second fault before a store, as the hardware would take.
+  for (int i = 0; i < 2 && (pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_COW))); i++) {
+    if (p == 0 || p->pagetable != pagetable)
+      return 0;
+    if (uvmfault(p, va0, write ? PTE_W : PTE_R) != 0)
+      return 0;
+    pte = walkleaf(pagetable, va0, &level);
+  }
+  if (pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0))
+    return 0;
+  // the copy stores to the page as the hardware would have;
+  // let vma_writeback() and the swap clock see that.
+  if (write)
+    *pte |= PTE_A | PTE_D;
+  return walkaddr(pagetable, va0);
+}
+
+// Let heap faults map megapages (1) or single pages only (0),
+// for benchmarks.
+void uvmmega_set(int on) { mega_on = on; }
+
+// Select copies through the user window (1) or the
+// walk-based path only (0), for benchmarks.
+void uaccess_set(int direct) { uaccess_direct = direct; }
+
+// Point this hart's user window at pagetable, if it is the
+// current process's and [va, va+len) lies below UWIN_SIZE.
+// Returns the kernel address of va in the window, or 0.
+// Interrupts must stay off while the window is in use, so
+// that no other process can take it over.
+static uint64 uwin_enter(pagetable_t pagetable, uint64 va, uint64 len) {
+  struct proc* p = myproc();
+  struct cpu* c = mycpu();
+
+  if (!uaccess_direct || p == 0 || p->pagetable != pagetable)
+    return 0;
+  if (va >= UWIN_SIZE || len > UWIN_SIZE - va)
+    return 0;
+
+  // user addresses below 1 GiB are all under root entry 0.
+  pte_t root = pagetable[0];
+  if ((root & PTE_V) == 0)
+    return 0;
+  if (c->uwin != root) {
+    c->kpagetable[PX(2, UWIN)] = root;
+    c->uwin = root;
+    sfence_vma_asid(0);
+  }
+  return UWIN + va;
+}
+
+// Copy n bytes within one page between the kernel buffer
+// kbuf and user address uva, through the user window.
+// Returns 0 on success, -1 if the window cannot be used
+// or the page is not accessible as it is; the caller then
+// falls back to the walk-based path, which can fault the
+// page in.
+static int uwin_copy(pagetable_t pagetable, uint64 uva, char* kbuf, uint64 n, int to_user) {
+  int r = -1;
+
+  push_off();
+  uint64 w = uwin_enter(pagetable, uva, n);
+  if (w != 0)
+    r = to_user ? uaccess_copy((char*)w, kbuf, n) : uaccess_copy(kbuf, (char*)w, n);
+  pop_off();
+  return r;
 }
 
 // Copy from kernel to user.
@@ -328,13 +993,15 @@ int copyout(pagetable_t pagetable, uint64 dstva, char* src, uint64 len) {
 
   while (len > 0) {
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0)
-      return -1;
     n = PGSIZE - (dstva - va0);
     if (n > len)
       n = len;
-    memmove((void*)(pa0 + (dstva - va0)), src, n);
+    if (uwin_copy(pagetable, dstva, src, n, 1) != 0) {
+      pa0 = useraddr(pagetable, va0, 1);
+      if (pa0 == 0)
+        return -1;
+      memmove((void*)(pa0 + (dstva - va0)), src, n);
+    }
 
     len -= n;
     src += n;
@@ -351,13 +1018,15 @@ int copyin(pagetable_t pagetable, char* dst, uint64 srcva, uint64 len) {
 
   while (len > 0) {
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0)
-      return -1;
     n = PGSIZE - (srcva - va0);
     if (n > len)
       n = len;
-    memmove(dst, (void*)(pa0 + (srcva - va0)), n);
+    if (uwin_copy(pagetable, srcva, dst, n, 0) != 0) {
+      pa0 = useraddr(pagetable, va0, 0);
+      if (pa0 == 0)
+        return -1;
+      memmove(dst, (void*)(pa0 + (srcva - va0)), n);
+    }
 
     len -= n;
     dst += n;
@@ -376,13 +1045,30 @@ int copyinstr(pagetable_t pagetable, char* dst, uint64 srcva, uint64 max) {
 
   while (got_null == 0 && max > 0) {
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if (pa0 == 0)
-      return -1;
     n = PGSIZE - (srcva - va0);
     if (n > max)
       n = max;
 
+    int r = -1;
+    push_off();
+    uint64 w = uwin_enter(pagetable, srcva, n);
+    if (w != 0)
+      r = uaccess_copystr(dst, (char*)w, n);
+    pop_off();
+    if (r > 0)
+      return 0;
+    if (r == 0) {
+      // no NUL in this page.
+      dst += n;
+      max -= n;
+      srcva = va0 + PGSIZE;
+      continue;
+    }
+
+    pa0 = useraddr(pagetable, va0, 0);
+    if (pa0 == 0)
+      return -1;
+
     char* p = (char*)(pa0 + (srcva - va0));
     while (n > 0) {
       if (*p == '\0') {
@@ -0,0 +1,378 @@
+#include "kernel/core/type.h"
+#include "kernel/core/param.h"
+#include "kernel/hardware/memlayout.h"
+#include "kernel/hardware/riscv.h"
+#include "kernel/sync/spinlock.h"
+#include "kernel/sync/sleeplock.h"
+#include "kernel/process/proc.h"
+#include "kernel/file/fs.h"
+#include "kernel/file/file.h"
+#include "kernel/defs.h"
+
+#include "vma.h"
+
+// Whether region v holds part of a program, read in from its
+// file on demand: the file must not be written while mapped,
+// see writei(). Files mapped with mmap() may be.
+static int vma_program(struct vma* v) {
+  return v->ip != 0 && (v->flags & VMA_MMAP) == 0;
+}
+
+// Add a region to vmas, taking a reference to ip.
+// Returns 0 on success, -1 if all NVMA slots are in use.
+int vma_map(
+    struct vma* vmas,
+    uint64 start,
+    uint64 end,
+    int perm,
+    int flags,
+    struct inode* ip,
+    uint off,
+    uint filesz
+) {
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &vmas[i];
+    if (v->start == v->end) {
+      v->start = start;
+      v->end = end;
+      v->perm = perm;
+      v->flags = flags;
+      v->ip = ip ? idup(ip) : 0;
+      v->off = off;
+      v->filesz = filesz;
+      v->shm = 0;
+      if (vma_program(v))
+        __sync_fetch_and_add(&ip->textref, 1);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Find the region containing va, or 0.
+struct vma* vma_find(struct vma* vmas, uint64 va) {
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &vmas[i];
+    if (v->start <= va && va < v->end)
+      return v;
+  }
+  return 0;
+}
+
+// Whether any region of vmas overlaps [start, end).
+int vma_overlap(struct vma* vmas, uint64 start, uint64 end) {
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &vmas[i];
+    if (v->start < v->end && v->start < end && start < v->end)
+      return 1;
+  }
+  return 0;
+}
+
+// Whether the page at va of region v is read from the file
+// and may be shared with other processes through the text
+// cache: no one can store to it. Sets the bytes of the file
+// the page holds in *off and *n.
+static int vma_text(struct vma* v, uint64 va, uint* off, uint* n) {
+  uint64 pos = va - v->start;
+  if (v->ip == 0 || pos >= v->filesz)
+    return 0;
+
+  *off = v->off + pos;
+  *n = v->filesz - pos;
+  if (*n > PGSIZE)
+    *n = PGSIZE;
+  return (v->perm & PTE_W) == 0 && (v->flags & VMA_SHARED) == 0;
+}
+
+// Look up the page at va of region v in the text cache.
+// Returns it with a reference for the caller, or 0 if the
+// page cannot be shared or was not read yet.
+char* vma_cached(struct vma* v, uint64 va) {
+  uint off, n;
+
+  if (!vma_text(v, va, &off, &n))
+    return 0;
+  return text_get(v->ip, off, n);
+}
+
+// Whether the current process may read a page in from a file.
+// Not while copying to or from user memory with a spinlock or
+// a sleep-lock held, such as the lock of an inode or a buffer
+// that the read may need itself: system calls fault their user
+// buffers in before taking those, see uvmtouch().
+static int canfill(void) {
+  push_off();
+  struct proc* p = mycpu()->proc;
+  int ok = mycpu()->noff == 1 && p != 0 && p->sleeplocks == 0;
+  pop_off();
+  return ok;
+}
+
+// Fill the page mem that will be mapped at va of region v,
+// reading the part backed by the file. mem must be zeroed.
+// A page of program text is added to the text cache.
+// Returns 0 on success, -1 if the file could not be read
+// or the caller holds locks the read might wait for.
+int vma_fill(struct vma* v, uint64 va, char* mem) {
+  uint64 pos = va - v->start;
+  if (v->ip == 0 || pos >= v->filesz)
+    return 0;
+
+  uint n = v->filesz - pos;
+  if (n > PGSIZE)
+    n = PGSIZE;
+
+  if (!canfill())
+    return -1;
+  ilock(v->ip);
+  int r = readi(v->ip, 0, (uint64)mem, v->off + pos, n);
+  uint toff, tn;
+  if (r == n && vma_text(v, va, &toff, &tn))
+    text_add(v->ip, toff, tn, mem);
+  iunlock(v->ip);
+  return r == n ? 0 : -1;
+}
+
+// Whether the page at va of region v starts out as all
+// zeros and may be the shared zero page until written:
+// it lies past the file-backed part, and stores to it
+// are private to the process.
+int vma_zero(struct vma* v, uint64 va) {
+  if (v->shm != 0 || (v->flags & VMA_SHARED))
+    return 0;
+  return v->ip == 0 || va - v->start >= v->filesz;
+}
+
+// Make dst a copy of src for a child process,
+// taking new references to the backing files.
+void vma_dup(struct vma* dst, struct vma* src) {
+  for (int i = 0; i < NVMA; i++) {
+    dst[i] = src[i];
+    if (dst[i].ip)
+      idup(dst[i].ip);
+    if (vma_program(&dst[i]))
+      __sync_fetch_and_add(&dst[i].ip->textref, 1);
+    if (dst[i].shm)
+      shm_dup(dst[i].shm);
+  }
+}
+
+// Forget all regions, dropping the file references.
+// Must be called inside a transaction, see iput().
+void vma_release(struct vma* vmas) {
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &vmas[i];
+    if (vma_program(v))
+      __sync_fetch_and_sub(&v->ip->textref, 1);
+    if (v->ip)
+      iput(v->ip);
+    v->start = v->end = 0;
+    v->flags = 0;
+    v->ip = 0;
+  }
+}
+
+// Lowest address of the mmap regions in vmas, up to which
+// the heap may grow; TRAPFRAME if there are none.
+uint64 vma_mmap_base(struct vma* vmas) {
+  uint64 base = TRAPFRAME;
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &vmas[i];
+    if ((v->flags & VMA_MMAP) && v->start < v->end && v->start < base)
+      base = v->start;
+  }
+  return base;
+}
+
+// Map len bytes of ip starting at off, or zeroes if ip is 0,
+// into p just below its lowest mmap region. The pages are
+// filled on first touch. Returns the address of the region,
+// or -1 if there is no room.
+uint64 vma_mmap(struct proc* p, uint64 len, int perm, int flags, struct inode* ip, uint off) {
+  uint64 base = vma_mmap_base(p->vmas);
+  uint filesz = 0;
+
+  len = PGROUNDUP(len);
+  if (len == 0 || len > base || base - len < PGROUNDUP(p->sz))
+    return -1;
+
+  if (ip) {
+    ilock(ip);
+    if (off < ip->size)
+      filesz = ip->size - off < len ? ip->size - off : len;
+    iunlock(ip);
+  }
+
+  if (vma_map(p->vmas, base - len, base, perm, flags | VMA_MMAP, ip, off, filesz) < 0)
+    return -1;
+  return base - len;
+}
+
+// Write the dirty pages of [start, end) of the shared
+// file region v back to the file, one transaction a page.
+static void vma_writeback(pagetable_t pagetable, struct vma* v, uint64 start, uint64 end) {
+  pte_t* pte;
+
+  for (uint64 va = start; (pte = walknext(pagetable, &va, end, 0)) != 0; va += PGSIZE) {
+    uint64 pos = va - v->start;
+    if (pos >= v->filesz)
+      break;
+    // the hardware sets PTE_D on the first store to a page.
+    if ((*pte & PTE_D) == 0)
+      continue;
+
+    uint n = v->filesz - pos;
+    if (n > PGSIZE)
+      n = PGSIZE;
+    begin_op();
+    ilock(v->ip);
+    writei(v->ip, 0, PTE2PA(*pte), v->off + pos, n);
+    iunlock(v->ip);
+    end_op();
+  }
+}
+
+// Remove the pages of [start, end) of region v from p,
+// writing dirty pages of a shared file region back first.
+static void vma_unmap(struct proc* p, struct vma* v, uint64 start, uint64 end) {
+  if ((v->flags & VMA_SHARED) && v->ip)
+    vma_writeback(p->pagetable, v, start, end);
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// Drop region v and its file reference.
+static void vma_drop(struct vma* v) {
+  if (vma_program(v))
+    __sync_fetch_and_sub(&v->ip->textref, 1);
+  if (v->ip) {
+    begin_op();
+    iput(v->ip);
+    end_op();
+  }
+  if (v->shm)
+    shm_put(v->shm);
+  v->start = v->end = 0;
+  v->flags = 0;
+  v->ip = 0;
+  v->shm = 0;
+}
+
+// Cut the program regions of p, which lie below p->sz, off
+// at sz when sbrk() shrinks p below them, dropping those
+// that lie wholly above it.
+void vma_trim(struct proc* p, uint64 sz) {
+  sz = PGROUNDUP(sz);
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &p->vmas[i];
+    if ((v->flags & VMA_MMAP) || v->start == v->end || v->end <= sz)
+      continue;
+    if (v->start >= sz) {
+      vma_drop(v);
+      continue;
+    }
+    v->end = sz;
+    if (v->filesz > sz - v->start)
+      v->filesz = sz - v->start;
+  }
+}
+
+// Unmap [addr, addr + len) from p. The range must lie in a
+// single mmap region; what remains of the region is kept.
+// Returns 0 on success, -1 on a bad range.
+int vma_munmap(struct proc* p, uint64 addr, uint64 len) {
+  uint64 end;
+  struct vma* v;
+
+  len = PGROUNDUP(len);
+  end = addr + len;
+  if (addr % PGSIZE != 0 || len == 0 || end < addr)
+    return -1;
+  if ((v = vma_find(p->vmas, addr)) == 0 || (v->flags & VMA_MMAP) == 0 || end > v->end)
+    return -1;
+  if (v->shm && (addr != v->start || end != v->end))
+    return -1; // segments are detached as a whole
+
+  if (v->start < addr && end < v->end) {
+    // a hole in the middle: the tail becomes a region of its own.
+    uint64 pos = end - v->start;
+    uint filesz = v->filesz > pos ? v->filesz - pos : 0;
+    if (vma_map(p->vmas, end, v->end, v->perm, v->flags, v->ip, v->off + pos, filesz) < 0)
+      return -1;
+    vma_unmap(p, v, addr, end);
+    v->end = addr;
+  } else if (v->start < addr) {
+    vma_unmap(p, v, addr, end);
+    v->end = addr;
+  } else if (end < v->end) {
+    vma_unmap(p, v, addr, end);
+    v->off += len;
+    v->filesz = v->filesz > len ? v->filesz - len : 0;
+    v->start = end;
+  } else {
+    vma_unmap(p, v, addr, end);
+    vma_drop(v);
+    return 0;
+  }
+
+  if (v->filesz > v->end - v->start)
+    v->filesz = v->end - v->start;
+  return 0;
+}
+
+// Unmap all mmap regions of p, on exit or exec.
+void vma_munmap_all(struct proc* p) {
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &p->vmas[i];
+    if ((v->flags & VMA_MMAP) && v->start < v->end) {
+      vma_unmap(p, v, v->start, v->end);
+      vma_drop(v);
+    }
+  }
+}
+
+// Fault in the untouched pages of p's shared regions,
+// so that a child created by fork() gets the same pages.
+// A region without access rights cannot be touched, by p
+// or a child, and is left alone. Faults use the region's
+// own access so that they pass its permission check.
+// Returns 0 on success, -1 if there is no memory.
+int vma_prefault(struct proc* p) {
+  for (int i = 0; i < NVMA; i++) {
+    struct vma* v = &p->vmas[i];
+    if ((v->flags & VMA_SHARED) == 0 || (v->perm & (PTE_R | PTE_X)) == 0)
+      continue;
+    int access = (v->perm & PTE_R) ? PTE_R : PTE_X;
+    for (uint64 va = v->start; va < v->end; va += PGSIZE) {
+      if (walkaddr(p->pagetable, va) == 0 && uvmfault(p, va, access) != 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Map the pages of p's mmap regions into the child np:
+// shared regions share the physical pages, see vma_prefault(),
+// private ones are copied on write.
+// Returns 0 on success, -1 with nothing mapped on failure.
+int vma_fork(struct proc* p, struct proc* np) {
+  int i;
+
+  for (i = 0; i < NVMA; i++) {
+    struct vma* v = &p->vmas[i];
+    if ((v->flags & VMA_MMAP) == 0 || v->start == v->end)
+      continue;
+    int shared = (v->flags & VMA_SHARED) != 0;
+    if (uvmshare(p->pagetable, np->pagetable, v->start, v->end, !shared) < 0)
+      goto err;
+  }
+  return 0;
+
+err:
+  while (--i >= 0) {
+    struct vma* v = &p->vmas[i];
+    if ((v->flags & VMA_MMAP) && v->start < v->end)
+      uvmunmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+  }
+  return -1;
+}
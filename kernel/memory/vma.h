@@ -0,0 +1,38 @@
+#ifndef XV6_KERNEL_VMA_H
+#define XV6_KERNEL_VMA_H
+
+/// Memory regions of a user address space
+///
+/// A region describes how the pages of [start, end) are
+/// filled when a process first touches them: the first
+/// filesz bytes come from inode ip starting at offset off,
+/// the rest is zero. Pages are mapped with perm.
+///
+/// Program segments lie below p->sz. Regions created by
+/// mmap() are placed top-down below TRAPFRAME, and the
+/// heap may grow up to the lowest of them.
+
+#include "../core/type.h"
+
+struct inode;
+struct shm;
+
+/// The region was created by mmap().
+#define VMA_MMAP (1 << 0)
+
+/// Stores are shared with other mappings and
+/// written back to the file (MAP_SHARED).
+#define VMA_SHARED (1 << 1)
+
+struct vma {
+  uint64 start;     // first address, page-aligned; 0 if unused
+  uint64 end;       // one past the last address, page-aligned
+  int perm;         // PTE_* bits of the mapped pages
+  int flags;        // VMA_*
+  struct inode* ip; // backing file, holds a reference
+  uint off;         // file offset of start
+  uint filesz;      // bytes of the region backed by the file
+  struct shm* shm;  // attached shared memory segment, see shm.h
+};
+
+#endif // XV6_KERNEL_VMA_H
@@ -7,8 +7,6 @@
 #include "kernel/defs.h"
 #include "kernel/process/elf.h"
 
-static int loadseg(pde_t*, uint64, struct inode*, uint, uint);
-
 int flags2perm(int flags) {
   int perm = 0;
   if (flags & 0x1)
@@ -18,7 +16,13 @@ int flags2perm(int flags) {
   return perm;
 }
 
-int exec(char* path, char** argv) {
+// Replace the user image of the current process.
+int exec(char* path, char** argv) { return execproc(myproc(), path, argv); }
+
+// Load the program at path into p, which is either the
+// current process or a new one that has not run yet.
+// Returns argc, the value main() finds in a0.
+int execproc(struct proc* p, char* path, char** argv) {
   char *s, *last;
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
@@ -26,7 +30,9 @@ int exec(char* path, char** argv) {
   struct inode* ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc* p = myproc();
+  struct vma vmas[NVMA];
+
+  memset(vmas, 0, sizeof(vmas));
 
   begin_op();
 
@@ -46,7 +52,8 @@ int exec(char* path, char** argv) {
   if ((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program segments; their pages are
+  // read from the file on first touch, see uvmfault().
   for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
     if (readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -58,31 +65,39 @@ int exec(char* path, char** argv) {
       goto bad;
     if (ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if ((sz1
-         = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags)))
-        == 0)
+    if (ph.vaddr < sz || ph.vaddr + ph.memsz >= TRAPFRAME)
       goto bad;
-    sz = sz1;
-    if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    uint64 end = PGROUNDUP(ph.vaddr + ph.memsz);
+    int perm = flags2perm(ph.flags) | PTE_R | PTE_U;
+    if (vma_map(vmas, ph.vaddr, end, perm, 0, ip, ph.off, ph.filesz) < 0)
       goto bad;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the second as the user stack.
+  // Reserve the stack at the next page boundary: a guard
+  // page without access rights, so that neither the user
+  // nor the kernel's direct user accesses can touch it,
+  // then p->stackpages pages the stack grows down into,
+  // filled on page faults like the heap. Only the top
+  // page, for the arguments, is allocated now. The stack
+  // lies below p->sz: sbrk() may give it back like any
+  // other memory, and then it is cut off, see vma_trim().
   sz = PGROUNDUP(sz);
+  if (vma_map(vmas, sz, sz + PGSIZE, 0, 0, 0, 0, 0) < 0)
+    goto bad;
+  uint64 stacksize = (uint64)p->stackpages * PGSIZE;
+  sz += PGSIZE;
+  if (vma_map(vmas, sz, sz + stacksize, PTE_R | PTE_W | PTE_U, 0, 0, 0, 0) < 0)
+    goto bad;
   uint64 sz1;
-  if ((sz1 = uvmalloc(pagetable, sz, sz + 2 * PGSIZE, PTE_W)) == 0)
+  if ((sz1 = uvmalloc(pagetable, sz + stacksize - PGSIZE, sz + stacksize, PTE_W)) == 0)
     goto bad;
   sz = sz1;
-  uvmclear(pagetable, sz - 2 * PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -120,46 +135,29 @@ int exec(char* path, char** argv) {
   safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
+  vma_munmap_all(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
   p->trapframe->epc = elf.entry; // initial program counter = main
   p->trapframe->sp = sp;         // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  uvmflush(p); // the ASID now names the new page table
+  begin_op();
+  vma_release(p->vmas);
+  end_op();
+  memmove(p->vmas, vmas, sizeof(vmas));
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
 bad:
   if (pagetable)
     proc_freepagetable(pagetable, sz);
-  if (ip) {
+  if (ip == 0)
+    begin_op();
+  vma_release(vmas);
+  if (ip)
     iunlockput(ip);
-    end_op();
-  }
+  end_op();
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int loadseg(
-    pagetable_t pagetable, uint64 va, struct inode* ip, uint offset, uint sz
-) {
-  uint i, n;
-  uint64 pa;
-
-  for (i = 0; i < sz; i += PGSIZE) {
-    pa = walkaddr(pagetable, va + i);
-    if (pa == 0)
-      panic("loadseg: address should exist");
-    if (sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if (readi(ip, 0, (uint64)pa, offset + i, n) != n)
-      return -1;
-  }
-
-  return 0;
-}
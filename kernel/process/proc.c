@@ -51,6 +51,7 @@ void procinit(void) {
     initlock(&p->lock, "proc");
     p->state = UNUSED;
     p->kstack = KSTACK((int)(p - proc));
+    p->asid = (int)(p - proc) + 1; // ASID 0 is the kernel's
   }
 }
 
@@ -93,10 +94,13 @@ int allocpid() {
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
-static struct proc* allocproc(void) {
+// If there are no free procs, or a memory allocation fails, return 0;
+// *nomem tells which, if nomem is not 0.
+static struct proc* allocproc(int* nomem) {
   struct proc* p;
 
+  if (nomem)
+    *nomem = 0;
   for (p = proc; p < &proc[NPROC]; p++) {
     acquire(&p->lock);
     if (p->state == UNUSED) {
@@ -108,8 +112,11 @@ static struct proc* allocproc(void) {
   return 0;
 
 found:
+  if (nomem)
+    *nomem = 1;
   p->pid = allocpid();
   p->state = USED;
+  p->stackpages = USTACK;
 
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe*)kalloc()) == 0) {
@@ -118,6 +125,9 @@ found:
     return 0;
   }
 
+  // The slot's ASID may still be cached from its last user.
+  uvmflush(p);
+
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if (p->pagetable == 0) {
@@ -152,6 +162,8 @@ static void freeproc(struct proc* p) {
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->sleeplocks = 0;
+  p->shmcreated = 0;
   p->state = UNUSED;
 }
 
@@ -211,7 +223,7 @@ uchar initcode[]
 void userinit(void) {
   struct proc* p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
 
   // allocate one user page and copy initcode's instructions
@@ -239,35 +251,67 @@ int growproc(int n) {
 
   sz = p->sz;
   if (n > 0) {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // only reserve the range, pages are allocated
+    // on first touch by uvmfault().
+    if (sz + n > vma_mmap_base(p->vmas)) {
       return -1;
     }
+    sz += n;
   } else if (n < 0) {
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if ((sz = uvmdealloc(p->pagetable, sz, sz + n)) == p->sz)
+      return -1;
+    vma_trim(p, sz);
   }
   p->sz = sz;
   return 0;
 }
 
-// Create a new process, copying the parent.
-// Sets up child kernel stack to return as if from fork() system call.
-int fork(void) {
-  int i, pid;
+// Allocate a child of p sharing its memory, for fork().
+// Returns it with its lock held, or 0 with *nomem set if
+// memory ran out and clear if no process slot is free.
+static struct proc* forkcopy(struct proc* p, int* nomem) {
   struct proc* np;
-  struct proc* p = myproc();
 
   // Allocate process.
-  if ((np = allocproc()) == 0) {
-    return -1;
+  if ((np = allocproc(nomem)) == 0) {
+    return 0;
   }
 
   // Copy user memory from parent to child.
   if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
     freeproc(np);
     release(&np->lock);
-    return -1;
+    return 0;
   }
   np->sz = p->sz;
+  np->stackpages = p->stackpages;
+  if (vma_fork(p, np) < 0) {
+    freeproc(np);
+    release(&np->lock);
+    return 0;
+  }
+  return np;
+}
+
+// Create a new process, copying the parent.
+// Sets up child kernel stack to return as if from fork() system call.
+int fork(void) {
+  int i, pid, nomem;
+  struct proc* np;
+  struct proc* p = myproc();
+
+  // Shared mappings must not diverge in untouched pages.
+  if (vma_prefault(p) < 0) {
+    return -1;
+  }
+
+  // Allocate process and copy user memory from parent to child,
+  // making room in swap if memory runs out. A full process
+  // table is no reason to push anything out.
+  while ((np = forkcopy(p, &nomem)) == 0) {
+    if (!nomem || swap_reclaim() == 0)
+      return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -280,6 +324,7 @@ int fork(void) {
     if (p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  vma_dup(np->vmas, p->vmas);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -298,6 +343,51 @@ int fork(void) {
   return pid;
 }
 
+// Create a new process running the program at path, without
+// copying the parent's memory as fork() followed by exec()
+// would. The child's file descriptors 0, 1 and 2 refer to
+// files[0..2], or are closed where those are 0; the child has
+// no other open files.
+int spawn(char* path, char** argv, struct file** files) {
+  int i, pid, argc;
+  struct proc* np;
+  struct proc* p = myproc();
+
+  // Allocate process.
+  if ((np = allocproc(0)) == 0) {
+    return -1;
+  }
+  // loading the program sleeps, the child stays USED meanwhile.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  np->stackpages = p->stackpages;
+  if ((argc = execproc(np, path, argv)) < 0) {
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  for (i = 0; i < 3; i++)
+    if (files[i])
+      np->ofile[i] = filedup(files[i]);
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void reparent(struct proc* p) {
@@ -329,8 +419,11 @@ void exit(int status) {
     }
   }
 
+  vma_munmap_all(p);
+  shm_exit(p);
   begin_op();
   iput(p->cwd);
+  vma_release(p->vmas);
   end_op();
   p->cwd = 0;
 
@@ -375,13 +468,17 @@ int wait(uint64 addr) {
         if (pp->state == ZOMBIE) {
           // Found one.
           pid = pp->pid;
-          if (addr != 0
-              && copyout(
-                     p->pagetable, addr, (char*)&pp->xstate, sizeof(pp->xstate)
-                 ) < 0) {
+          if (addr != 0) {
+            // copyout() may have to fault the page in, which it
+            // cannot do with the locks held. Only p reaps pp,
+            // so pp stays a zombie meanwhile.
+            int xstate = pp->xstate;
             release(&pp->lock);
             release(&wait_lock);
-            return -1;
+            if (copyout(p->pagetable, addr, (char*)&xstate, sizeof(xstate)) < 0)
+              return -1;
+            acquire(&wait_lock);
+            acquire(&pp->lock);
           }
           freeproc(pp);
           release(&pp->lock);
@@ -420,14 +517,17 @@ void scheduler(void) {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
+    int found = 0;
     for (p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
       if (p->state == RUNNABLE) {
+        found = 1;
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+        uvmswitch(p);
         swtch(&c->context, &p->context);
 
         // Process is done running for now.
@@ -436,6 +536,13 @@ void scheduler(void) {
       }
       release(&p->lock);
     }
+
+    if (!found) {
+      // Nothing to run: spend the idle time zeroing a page
+      // for kalloc_zeroed(), one page per pass so that newly
+      // runnable processes are picked up quickly.
+      kzero_refill();
+    }
   }
 }
 
@@ -491,6 +598,7 @@ void forkret(void) {
     // be run from main().
     first = 0;
     fsinit(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   usertrapret();
@@ -1,5 +1,6 @@
 #include "kernel/core/type.h"
 #include "kernel/sync/spinlock.h"
+#include "kernel/memory/vma.h"
 
 // Saved registers for kernel context switches.
 struct context {
@@ -27,6 +28,9 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  pagetable_t kpagetable;     // Copy of kernel_pagetable with the user window.
+  pte_t uwin;                 // User root entry installed in the window.
+  int asidgen;                // Value of asidgen in vm.c last seen.
 };
 
 extern struct cpu cpus[NCPU];
@@ -101,10 +105,16 @@ struct proc {
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  int stackpages;              // Stack limit for exec, in pages
   pagetable_t pagetable;       // User page table
+  int asid;                    // Address space ID, fixed per slot
+  int sleeplocks;              // Sleep-locks held, see vma_fill()
+  uint shmcreated;             // Bit i: created segment i, see shm_get()
+  uint tlbstale;               // CPUs to flush asid on, updated atomically
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vma vmas[NVMA];       // Regions of memory filled on page fault
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 };
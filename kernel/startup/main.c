@@ -25,6 +25,9 @@ void main() {
     binit();            // buffer cache
     iinit();            // inode table
     fileinit();         // file table
+    pipeinit();         // pipe buffers
+    shminit();          // shared memory segments
+    textinit();         // program text cache
     virtio_disk_init(); // emulated hard disk
     userinit();         // first user process
     __sync_synchronize();
@@ -41,6 +41,9 @@ void start() {
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // allow supervisor mode to read the cycle and time counters.
+  w_mcounteren(r_mcounteren() | MCOUNTEREN_CY | MCOUNTEREN_TM);
+
   // ask for clock interrupts.
   timerinit();
 
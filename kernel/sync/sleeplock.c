@@ -24,6 +24,7 @@ void acquiresleep(struct sleeplock* lk) {
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  myproc()->sleeplocks++;
   release(&lk->lk);
 }
 
@@ -31,6 +32,7 @@ void releasesleep(struct sleeplock* lk) {
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  myproc()->sleeplocks--;
   wakeup(lk);
   release(&lk->lk);
 }
@@ -13,6 +13,8 @@ void initlock(struct spinlock* lk, char* name) {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->ncontended = 0;
 }
 
 void acquire(struct spinlock* lk) {
@@ -25,8 +27,11 @@ void acquire(struct spinlock* lk) {
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
-    // Do nothing
+  if (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+    __sync_fetch_and_add(&lk->ncontended, 1);
+    while (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
+      // Do nothing
+    }
   }
 
   // Tell the C compiler and the processor to not move loads or stores
@@ -37,6 +42,7 @@ void acquire(struct spinlock* lk) {
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->nacquire++;
 }
 
 // Release the lock.
@@ -10,6 +10,10 @@ struct spinlock {
   // For debugging:
   char* name;      // Name of lock.
   struct cpu* cpu; // The cpu holding the lock.
+
+  // For statistics:
+  uint64 nacquire;   // Number of acquisitions.
+  uint64 ncontended; // Acquisitions that had to spin.
 };
 
 /// Init lock
@@ -90,6 +90,15 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_dump(void);
 extern uint64 sys_dump2(void);
+extern uint64 sys_memctl(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shmget(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_stacklimit(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -105,7 +114,11 @@ static uint64 (*syscalls[])(void) = {
     [SYS_mknod] = sys_mknod,   [SYS_unlink] = sys_unlink,
     [SYS_link] = sys_link,     [SYS_mkdir] = sys_mkdir,
     [SYS_close] = sys_close,   [SYS_dump] = sys_dump,
-    [SYS_dump2] = sys_dump2,
+    [SYS_dump2] = sys_dump2,   [SYS_memctl] = sys_memctl,
+    [SYS_memstat] = sys_memstat, [SYS_mmap] = sys_mmap,
+    [SYS_munmap] = sys_munmap, [SYS_shmget] = sys_shmget,
+    [SYS_shmat] = sys_shmat,   [SYS_shmdt] = sys_shmdt,
+    [SYS_spawn] = sys_spawn,   [SYS_stacklimit] = sys_stacklimit,
 };
 
 void syscall(void) {
@@ -22,3 +22,12 @@
 #define SYS_close  21
 #define SYS_dump   22
 #define SYS_dump2  23
+#define SYS_memctl 24
+#define SYS_memstat 25
+#define SYS_mmap   26
+#define SYS_munmap 27
+#define SYS_shmget 28
+#define SYS_shmat  29
+#define SYS_shmdt  30
+#define SYS_spawn  31
+#define SYS_stacklimit 32
@@ -319,6 +319,14 @@ uint64 sys_open(void) {
     return -1;
   }
 
+  // a running program reads its pages in from ip on demand,
+  // so it must not change meanwhile.
+  if (ip->textref > 0 && (omode & (O_WRONLY | O_RDWR | O_TRUNC))) {
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
     if (f)
       fileclose(f);
@@ -403,18 +411,24 @@ uint64 sys_chdir(void) {
   return 0;
 }
 
-uint64 sys_exec(void) {
-  char path[MAXPATH], *argv[MAXARG];
-  int i;
-  uint64 uargv, uarg;
+static void freeargv(char** argv) {
+  for (int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kmfree(argv[i]);
+}
 
-  argaddr(1, &uargv);
-  if (argstr(0, path, MAXPATH) < 0) {
+// Fetch the argument vector at user address uargv into argv.
+// Each string is read into a page, then kept in a kmalloc()
+// block of its own size. Returns 0, or -1 after freeing them.
+static int fetchargv(uint64 uargv, char** argv) {
+  int i, n;
+  uint64 uarg;
+  char* buf;
+
+  memset(argv, 0, MAXARG * sizeof(char*));
+  if ((buf = kalloc()) == 0)
     return -1;
-  }
-  memset(argv, 0, sizeof(argv));
   for (i = 0;; i++) {
-    if (i >= NELEM(argv)) {
+    if (i >= MAXARG) {
       goto bad;
     }
     if (fetchaddr(uargv + sizeof(uint64) * i, (uint64*)&uarg) < 0) {
@@ -424,24 +438,68 @@ uint64 sys_exec(void) {
       argv[i] = 0;
       break;
     }
-    argv[i] = kalloc();
-    if (argv[i] == 0)
+    if ((n = fetchstr(uarg, buf, PGSIZE)) < 0)
       goto bad;
-    if (fetchstr(uarg, argv[i], PGSIZE) < 0)
+    if ((argv[i] = kmalloc(n + 1)) == 0)
       goto bad;
+    memmove(argv[i], buf, n + 1);
   }
+  kfree(buf);
+  return 0;
 
-  int ret = exec(path, argv);
+bad:
+  kfree(buf);
+  freeargv(argv);
+  return -1;
+}
 
-  for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64 sys_exec(void) {
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
 
+  argaddr(1, &uargv);
+  if (argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if (fetchargv(uargv, argv) < 0) {
+    return -1;
+  }
+
+  int ret = exec(path, argv);
+
+  freeargv(argv);
   return ret;
+}
 
-bad:
-  for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64 sys_spawn(void) {
+  char path[MAXPATH], *argv[MAXARG];
+  struct file* files[3];
+  int fds[3];
+  uint64 uargv, ufds;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  if (argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if (copyin(myproc()->pagetable, (char*)fds, ufds, sizeof(fds)) < 0) {
+    return -1;
+  }
+  for (int i = 0; i < 3; i++) {
+    files[i] = 0;
+    if (fds[i] == -1)
+      continue;
+    if (fds[i] < 0 || fds[i] >= NOFILE || (files[i] = myproc()->ofile[fds[i]]) == 0)
+      return -1;
+  }
+  if (fetchargv(uargv, argv) < 0) {
+    return -1;
+  }
+
+  int ret = spawn(path, argv, files);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64 sys_pipe(void) {
@@ -472,3 +530,48 @@ uint64 sys_pipe(void) {
   }
   return 0;
 }
+
+uint64 sys_mmap(void) {
+  uint64 len;
+  int prot, flags, off;
+  int perm = PTE_U;
+  int vflags = 0;
+  struct file* f = 0;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+
+  if (((flags & MAP_SHARED) == 0) == ((flags & MAP_PRIVATE) == 0))
+    return -1;
+  if (off < 0 || off % PGSIZE != 0)
+    return -1;
+  if ((flags & MAP_ANONYMOUS) == 0) {
+    if (argfd(4, 0, &f) < 0 || f->type != FD_INODE)
+      return -1;
+    if (!f->readable)
+      return -1;
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  if (prot & PROT_READ)
+    perm |= PTE_R;
+  if (prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  if (prot & PROT_EXEC)
+    perm |= PTE_X;
+  if (flags & MAP_SHARED)
+    vflags |= VMA_SHARED;
+
+  return vma_mmap(myproc(), len, perm, vflags, f ? f->ip : 0, off);
+}
+
+uint64 sys_munmap(void) {
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return vma_munmap(myproc(), addr, len);
+}
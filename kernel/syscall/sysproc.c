@@ -5,6 +5,7 @@
 #include "kernel/hardware/memlayout.h"
 #include "kernel/sync/spinlock.h"
 #include "kernel/process/proc.h"
+#include "kernel/alloc/memstat.h"
 
 uint64 sys_exit(void) {
   int n;
@@ -34,6 +35,22 @@ uint64 sys_sbrk(void) {
   return addr;
 }
 
+// Set the stack limit, in pages, that the next exec() by this
+// process or its children gives the program; npages <= 0 only
+// asks. Returns the previous limit.
+uint64 sys_stacklimit(void) {
+  struct proc* p = myproc();
+  int npages;
+
+  argint(0, &npages);
+  if (npages > MAXUSTACK)
+    return -1;
+  int old = p->stackpages;
+  if (npages > 0)
+    p->stackpages = npages;
+  return old;
+}
+
 uint64 sys_sleep(void) {
   int n;
   uint ticks0;
@@ -82,4 +99,50 @@ uint64 sys_dump2(void) {
   argaddr(2, &return_value);
 
   return dump2(pid, register_num, return_value);
-}
\ No newline at end of file
+}
+
+uint64 sys_memctl(void) {
+  int op = 0;
+  int arg = 0;
+
+  argint(0, &op);
+  argint(1, &arg);
+
+  return memctl(op, arg);
+}
+
+uint64 sys_memstat(void) {
+  uint64 addr; // user pointer to struct memstat
+  struct memstat st;
+
+  argaddr(0, &addr);
+  kmemstat(&st);
+  uvmstat(&st);
+  swapstat(&st);
+  textstat(&st);
+  if (copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64 sys_shmget(void) {
+  int key, size;
+
+  argint(0, &key);
+  argint(1, &size);
+  return shm_get(myproc(), key, size);
+}
+
+uint64 sys_shmat(void) {
+  int id;
+
+  argint(0, &id);
+  return shm_attach(myproc(), id);
+}
+
+uint64 sys_shmdt(void) {
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return shm_detach(myproc(), addr);
+}
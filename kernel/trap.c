@@ -16,6 +16,42 @@ void kernelvec();
 
 extern int devintr();
 
+// uaccess.S: code ranges that may fault on user memory,
+// and where to resume when they do.
+struct extable {
+  uint64 begin;
+  uint64 end;
+  uint64 fixup;
+};
+extern struct extable uaccess_extable[];
+
+// If a page fault at sepc was raised by a user access
+// listed in the exception table, return the address to
+// resume at, or 0.
+static uint64 search_extable(uint64 sepc, uint64 scause) {
+  if (scause != 13 && scause != 15)
+    return 0;
+  for (struct extable* e = uaccess_extable; e->fixup != 0; e++) {
+    if (e->begin <= sepc && sepc < e->end)
+      return e->fixup;
+  }
+  return 0;
+}
+
+// The access that raised page fault scause, as the PTE
+// bit it needs, or 0 if scause is not a page fault.
+static int faultaccess(uint64 scause) {
+  switch (scause) {
+  case 12:
+    return PTE_X;
+  case 13:
+    return PTE_R;
+  case 15:
+    return PTE_W;
+  }
+  return 0;
+}
+
 void trapinit(void) { initlock(&tickslock, "time"); }
 
 // set up to take exceptions and traps while in the kernel.
@@ -27,6 +63,7 @@ void trapinithart(void) { w_stvec((uint64)kernelvec); }
 //
 void usertrap(void) {
   int which_dev = 0;
+  int access;
 
   if ((r_sstatus() & SSTATUS_SPP) != 0)
     panic("usertrap: not from user mode");
@@ -55,6 +92,10 @@ void usertrap(void) {
     intr_on();
 
     syscall();
+  } else if ((access = faultaccess(r_scause())) != 0
+             && uvmfault(p, r_stval(), access) == 0) {
+    // instruction, load or store page fault on a page filled
+    // on demand or a copy-on-write page, which is now mapped
   } else if ((which_dev = devintr()) != 0) {
     // ok
   } else {
@@ -108,7 +149,7 @@ void usertrapret(void) {
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = uvmsatp(p);
 
   // jump to userret in trampoline.S at the top of memory, which
   // switches to the user page table, restores user registers,
@@ -130,6 +171,13 @@ void kerneltrap() {
   if (intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  uint64 fixup = search_extable(sepc, scause);
+  if (fixup != 0) {
+    w_sepc(fixup);
+    w_sstatus(sstatus);
+    return;
+  }
+
   if ((which_dev = devintr()) == 0) {
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -98,21 +98,25 @@ int main(int argc, char* argv[]) {
   sb.logstart = xint(2);
   sb.inodestart = xint(2 + nlog);
   sb.bmapstart = xint(2 + nlog + ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(NSWAP);
 
   printf(
       "nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) "
-      "blocks %d total %d\n",
+      "blocks %d total %d swap %d\n",
       nmeta,
       nlog,
       ninodeblocks,
       nbitmap,
       nblocks,
-      FSSIZE
+      FSSIZE,
+      NSWAP
   );
 
   freeblock = nmeta; // the first free block that we can allocate
 
-  for (i = 0; i < FSSIZE; i++)
+  // the swap area follows the file system.
+  for (i = 0; i < FSSIZE + NSWAP; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
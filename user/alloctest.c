@@ -6,6 +6,8 @@
 #include "kernel/hardware/memlayout.h"
 #include "user/user.h"
 #include "kernel/file/fcntl.h"
+#include "kernel/alloc/memctl.h"
+#include "kernel/alloc/memstat.h"
 
 void test0() {
   enum { NCHILD = 50, NFD = 10 };
@@ -101,7 +103,160 @@ void test1() {
   }
 }
 
+// Print how many blocks of every order the kernel can hand out,
+// and which share of the free pages they cover.
+void print_orders(int free) {
+  for (int order = 0; order <= 10; order++) {
+    int count = memctl(MEMCTL_PROBE, order);
+    int covered = free > 0 ? (int)(((uint64)count << order) * 100 / free) : 0;
+    printf("  order %d: %d blocks, %d%% of free pages\n", order, count, covered);
+  }
+}
+
+// Fragment physical memory with processes of different sizes,
+// let every other one exit, and measure how often high-order
+// allocations still succeed.
+void test2() {
+  enum { NCHILD = 24, CHUNK = 16 };
+  int pids[NCHILD];
+  int ready[2];
+  int hold[2];
+  char c;
+
+  printf("fragtest: start\n");
+
+  printf("fragtest: before fragmentation\n");
+  print_orders(memctl(MEMCTL_PROBE, 0));
+
+  if (pipe(ready) != 0 || pipe(hold) != 0) {
+    printf("pipe() failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < NCHILD; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      printf("fork failed\n");
+      exit(1);
+    }
+    if (pids[i] == 0) {
+      close(ready[0]);
+      close(hold[1]);
+      int npages = (i % 7 + 1) * CHUNK;
+      char* a = sbrk(npages * PGSIZE);
+      if (a == (char*)0xffffffffffffffffL)
+        exit(1);
+      for (int j = 0; j < npages; j++)
+        a[j * PGSIZE] = 1;
+      write(ready[1], "x", 1);
+      read(hold[0], &c, 1); // until killed or released
+      exit(0);
+    }
+    // wait for the child, so that the children's pages interleave
+    if (read(ready[0], &c, 1) != 1) {
+      printf("fragtest: child %d failed\n", i);
+      exit(1);
+    }
+  }
+
+  for (int i = 0; i < NCHILD; i += 2) {
+    kill(pids[i]);
+    wait(0);
+  }
+
+  int free = memctl(MEMCTL_PROBE, 0);
+  printf("fragtest: after fragmentation, %d free pages\n", free);
+  print_orders(free);
+
+  close(hold[1]);
+  for (int i = 1; i < NCHILD; i += 2)
+    wait(0);
+  close(ready[0]);
+  close(ready[1]);
+  close(hold[0]);
+
+  printf("fragtest: OK\n");
+}
+
+// compare eager and lazy coalescing under single page churn.
+void test3() {
+  enum { ROUNDS = 20000 };
+
+  printf("lazytest: start\n");
+
+  int free = memctl(MEMCTL_PROBE, 0);
+  if (memctl(MEMCTL_COALESCE, 0) != 0) {
+    printf("lazytest: memctl failed\n");
+    exit(1);
+  }
+  int eager = memctl(MEMCTL_CHURN, ROUNDS);
+  memctl(MEMCTL_COALESCE, 1);
+  int lazy = memctl(MEMCTL_CHURN, ROUNDS);
+  memctl(MEMCTL_COALESCE, 0);
+
+  printf("lazytest: %d rounds, eager %d kcycles, lazy %d kcycles\n", ROUNDS, eager, lazy);
+
+  if (memctl(MEMCTL_PROBE, 0) < free) {
+    printf("lazytest: lost free pages\n");
+    exit(1);
+  }
+
+  printf("lazytest: OK\n");
+}
+
+// grow past physical memory, so that pages must go to the
+// swap area and come back intact.
+void test4() {
+  struct memstat st;
+
+  printf("swaptest: start\n");
+
+  if (memstat(&st) < 0) {
+    printf("swaptest: memstat failed\n");
+    exit(1);
+  }
+  uint64 size = st.free_bytes + st.cached_pages * PGSIZE + 4 * 1024 * 1024;
+  if (size > (uint64)st.swap_slots * PGSIZE) {
+    printf("swaptest: swap area too small\n");
+    exit(1);
+  }
+  char* base = sbrk((int)size);
+  if (base == (char*)-1) {
+    printf("swaptest: sbrk failed\n");
+    exit(1);
+  }
+  for (uint64 off = 0; off < size; off += PGSIZE)
+    *(uint64*)(base + off) = off;
+  for (uint64 off = 0; off < size; off += PGSIZE) {
+    if (*(uint64*)(base + off) != off) {
+      printf("swaptest: bad page at offset %l\n", off);
+      exit(1);
+    }
+  }
+  sbrk(-(int)size);
+
+  memstat(&st);
+  printf("swaptest: %l pages out, %l in\n", st.swap_outs, st.swap_ins);
+  if (st.swap_outs == 0) {
+    printf("swaptest: nothing was swapped\n");
+    exit(1);
+  }
+
+  printf("swaptest: OK\n");
+}
+
 int main(int argc, char* argv[]) {
+  if (argc > 1 && strcmp(argv[1], "frag") == 0) {
+    test2();
+    exit(0);
+  }
+  if (argc > 1 && strcmp(argv[1], "lazy") == 0) {
+    test3();
+    exit(0);
+  }
+  if (argc > 1 && strcmp(argv[1], "swap") == 0) {
+    test4();
+    exit(0);
+  }
   test0();
   test1();
   exit(0);
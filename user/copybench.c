@@ -0,0 +1,83 @@
+#include "kernel/core/type.h"
+#include "kernel/file/fcntl.h"
+#include "kernel/alloc/memctl.h"
+#include "user/user.h"
+
+// Compare large read and write system calls with copyout()
+// and copyin() going through the user window and walking the
+// page table. Writes also commit to the disk log, which takes
+// most of their time.
+//
+//   copybench [rounds]
+
+#define FILESIZE (16 * 1024) // fits in the buffer cache
+#define FILENAME "copybench.tmp"
+
+static char buf[FILESIZE];
+
+void mkfile(void) {
+  int fd = open(FILENAME, O_CREATE | O_RDWR | O_TRUNC);
+  if (fd < 0) {
+    fprintf(2, "copybench: cannot create %s\n", FILENAME);
+    exit(1);
+  }
+  memset(buf, 'c', sizeof(buf));
+  if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+    fprintf(2, "copybench: write failed\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+int readbench(int rounds) {
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    int fd = open(FILENAME, O_RDONLY);
+    if (fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      fprintf(2, "copybench: read failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  return uptime() - start;
+}
+
+int writebench(int rounds) {
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    // overwrite the same blocks, allocating none.
+    int fd = open(FILENAME, O_RDWR);
+    if (fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      fprintf(2, "copybench: write failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  return uptime() - start;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+  if (rounds <= 0) {
+    fprintf(2, "usage: copybench [rounds]\n");
+    exit(1);
+  }
+
+  mkfile();
+  readbench(1); // warm up the buffer cache
+
+  if (memctl(MEMCTL_UACCESS, 0) < 0) {
+    fprintf(2, "copybench: memctl failed\n");
+    exit(1);
+  }
+  int walk = readbench(rounds);
+  int wwalk = writebench(rounds / 10);
+  memctl(MEMCTL_UACCESS, 1);
+  int direct = readbench(rounds);
+  int wdirect = writebench(rounds / 10);
+
+  unlink(FILENAME);
+  printf("copybench: %d reads of %d bytes: walk %d ticks, direct %d ticks\n", rounds, FILESIZE, walk, direct);
+  printf("copybench: %d writes of %d bytes: walk %d ticks, direct %d ticks\n", rounds / 10, FILESIZE, wwalk, wdirect);
+  exit(0);
+}
@@ -9,6 +9,18 @@
 
 void print(const char* s) { write(1, s, strlen(s)); }
 
+void printnum(int n) {
+  char buf[16];
+  int i = sizeof(buf);
+
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  print(buf + i);
+}
+
 void forktest(void) {
   int n, pid;
 
@@ -42,7 +54,45 @@ void forktest(void) {
   print("fork test OK\n");
 }
 
+// Time fork+exit+wait of a process with a large, touched heap.
+void forktime(void) {
+  enum { NFORK = 200, HEAP = 1024 * 1024 };
+  int pid;
+
+  char* heap = sbrk(HEAP);
+  if (heap == (char*)-1) {
+    print("sbrk failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < HEAP; i += 4096)
+    heap[i] = 1;
+
+  int start = uptime();
+  for (int n = 0; n < NFORK; n++) {
+    pid = fork();
+    if (pid < 0) {
+      print("fork failed\n");
+      exit(1);
+    }
+    if (pid == 0)
+      exit(0);
+    wait(0);
+  }
+  int ticks = uptime() - start;
+
+  print("fork latency: ");
+  printnum(ticks);
+  print(" ticks for ");
+  printnum(NFORK);
+  print(" forks of a ");
+  printnum(HEAP / 1024);
+  print(" KiB process\n");
+
+  sbrk(-HEAP);
+}
+
 int main(void) {
   forktest();
+  forktime();
   exit(0);
 }
@@ -0,0 +1,50 @@
+#include "kernel/core/type.h"
+#include "kernel/alloc/memctl.h"
+#include "user/user.h"
+
+// Compare sweeping a large heap mapped with 4 KiB pages and
+// with 2 MiB megapages, which need far fewer TLB entries.
+// Each round stores to every page of the heap once.
+//
+//   megabench [rounds]
+
+#define MEGA (2 * 1024 * 1024)
+#define NMEGA 8
+#define PGSIZE 4096
+
+int bench(int rounds) {
+  char* p = sbrk((NMEGA + 1) * MEGA);
+  if (p == (char*)-1) {
+    fprintf(2, "megabench: sbrk failed\n");
+    exit(1);
+  }
+  char* heap = (char*)(((uint64)p + MEGA - 1) & ~(uint64)(MEGA - 1));
+
+  for (int i = 0; i < NMEGA * MEGA; i += PGSIZE)
+    heap[i] = 1; // fault the heap in
+
+  int start = uptime();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < NMEGA * MEGA; i += PGSIZE)
+      heap[i + r % PGSIZE]++;
+  int ticks = uptime() - start;
+
+  sbrk(-(NMEGA + 1) * MEGA);
+  return ticks;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  if (rounds <= 0) {
+    fprintf(2, "usage: megabench [rounds]\n");
+    exit(1);
+  }
+
+  memctl(MEMCTL_MEGAPAGE, 0);
+  int pages = bench(rounds);
+  memctl(MEMCTL_MEGAPAGE, 1);
+  int mega = bench(rounds);
+
+  printf("megabench: %d rounds over %d MiB: pages %d ticks, megapages %d ticks\n", rounds, NMEGA * 2, pages, mega);
+  exit(0);
+}
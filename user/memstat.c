@@ -0,0 +1,78 @@
+#include "kernel/core/type.h"
+#include "kernel/alloc/memstat.h"
+#include "user/user.h"
+
+// Print physical memory allocator statistics.
+//
+//   memstat                  print once, with free blocks of each size
+//   memstat ticks [count]    sample every ticks, count times (forever if 0)
+//
+// In sampling mode counters are printed as deltas since the last sample.
+
+void print_full(struct memstat* st) {
+  printf("free: %l bytes, %l cached pages, fragmentation %d/1000\n",
+         st->free_bytes, st->cached_pages, st->frag);
+  printf("free blocks:\n");
+  for (int k = 0; k < st->nsizes; k++) {
+    if (st->free_blocks[k] > 0)
+      printf("  %l bytes: %d\n", st->leaf_size << k, st->free_blocks[k]);
+  }
+  printf("buddy: %l allocs, %l frees\n", st->buddy_allocs, st->buddy_frees);
+  printf("kalloc: %l allocs, %l frees\n", st->kallocs, st->kfrees);
+  printf("buddy lock: %l acquires, %l contended\n",
+         st->buddy_lock_acquires, st->buddy_lock_contended);
+  printf("kmag locks: %l acquires, %l contended\n",
+         st->kmag_lock_acquires, st->kmag_lock_contended);
+  printf("demand-zero faults: %l, file faults: %l\n", st->zero_faults, st->file_faults);
+  printf("zero page maps: %l\n", st->zero_maps);
+  printf("megapages: %l mapped, %l split\n", st->mega_maps, st->mega_splits);
+  printf("text cache: %d pages, %l hits\n", st->text_pages, st->text_hits);
+  printf("swap: %d/%d pages used, %l out, %l in\n",
+         st->swap_used, st->swap_slots, st->swap_outs, st->swap_ins);
+}
+
+void print_sample(struct memstat* st, struct memstat* prev) {
+  printf("%l %l %d  %l %l  %l %l  %l %l\n",
+         st->free_bytes,
+         st->cached_pages,
+         st->frag,
+         st->kallocs - prev->kallocs,
+         st->kfrees - prev->kfrees,
+         st->buddy_allocs - prev->buddy_allocs,
+         st->buddy_frees - prev->buddy_frees,
+         st->buddy_lock_acquires - prev->buddy_lock_acquires,
+         st->buddy_lock_contended - prev->buddy_lock_contended);
+}
+
+int main(int argc, char* argv[]) {
+  struct memstat st;
+  struct memstat prev;
+
+  if (memstat(&st) < 0) {
+    fprintf(2, "memstat: failed\n");
+    exit(1);
+  }
+  if (argc < 2) {
+    print_full(&st);
+    exit(0);
+  }
+
+  int ticks = atoi(argv[1]);
+  int count = argc > 2 ? atoi(argv[2]) : 0;
+  if (ticks <= 0) {
+    fprintf(2, "usage: memstat [ticks [count]]\n");
+    exit(1);
+  }
+
+  printf("free cached frag  kalloc kfree  balloc bfree  lock contended\n");
+  for (int i = 0; count == 0 || i < count; i++) {
+    prev = st;
+    sleep(ticks);
+    if (memstat(&st) < 0) {
+      fprintf(2, "memstat: failed\n");
+      exit(1);
+    }
+    print_sample(&st, &prev);
+  }
+  exit(0);
+}
@@ -53,8 +53,44 @@ struct backcmd {
 int fork1(void); // Fork but panics on failure.
 void panic(char*);
 struct cmd* parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
+// Can cmd be started with spawn() instead of fork()?
+// True for a program with any redirections.
+int spawnable(struct cmd* cmd) {
+  while (cmd != 0 && cmd->type == REDIR)
+    cmd = ((struct redircmd*)cmd)->cmd;
+  return cmd != 0 && cmd->type == EXEC && ((struct execcmd*)cmd)->argv[0] != 0;
+}
+
+// Start spawnable cmd in a child whose fds 0, 1 and 2 are the
+// shell's fds[0..2], as redirected by cmd. Returns the pid of
+// the child, or -1.
+int spawncmd(struct cmd* cmd, int* fds) {
+  struct execcmd* ecmd;
+  struct redircmd* rcmd;
+  int cfds[3], fd, pid;
+
+  if (cmd->type == EXEC) {
+    ecmd = (struct execcmd*)cmd;
+    if ((pid = spawn(ecmd->argv[0], ecmd->argv, fds)) < 0)
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+    return pid;
+  }
+
+  rcmd = (struct redircmd*)cmd;
+  if ((fd = open(rcmd->file, rcmd->mode)) < 0) {
+    fprintf(2, "open %s failed\n", rcmd->file);
+    return -1;
+  }
+  memmove(cfds, fds, sizeof(cfds));
+  cfds[rcmd->fd] = fd;
+  pid = spawncmd(rcmd->cmd, cfds);
+  close(fd);
+  return pid;
+}
+
 // Execute cmd.  Never returns.
 void runcmd(struct cmd* cmd) {
   int p[2];
@@ -91,9 +127,15 @@ void runcmd(struct cmd* cmd) {
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if (fork1() == 0)
-      runcmd(lcmd->left);
-    wait(0);
+    if (spawnable(lcmd->left)) {
+      int fds[3] = {0, 1, 2};
+      if (spawncmd(lcmd->left, fds) >= 0)
+        wait(0);
+    } else {
+      if (fork1() == 0)
+        runcmd(lcmd->left);
+      wait(0);
+    }
     runcmd(lcmd->right);
     break;
 
@@ -101,14 +143,20 @@ void runcmd(struct cmd* cmd) {
     pcmd = (struct pipecmd*)cmd;
     if (pipe(p) < 0)
       panic("pipe");
-    if (fork1() == 0) {
+    if (spawnable(pcmd->left)) {
+      int fds[3] = {0, p[1], 2};
+      spawncmd(pcmd->left, fds);
+    } else if (fork1() == 0) {
       close(1);
       dup(p[1]);
       close(p[0]);
       close(p[1]);
       runcmd(pcmd->left);
     }
-    if (fork1() == 0) {
+    if (spawnable(pcmd->right)) {
+      int fds[3] = {p[0], 1, 2};
+      spawncmd(pcmd->right, fds);
+    } else if (fork1() == 0) {
       close(0);
       dup(p[0]);
       close(p[0]);
@@ -160,9 +208,20 @@ int main(void) {
         fprintf(2, "cannot cd %s\n", buf + 3);
       continue;
     }
-    if (fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    struct cmd* cmd = parsecmd(buf);
+    if (cmd == 0)
+      continue;
+    if (spawnable(cmd)) {
+      // no need to copy the shell just to replace the copy.
+      int fds[3] = {0, 1, 2};
+      if (spawncmd(cmd, fds) >= 0)
+        wait(0);
+    } else if (fork1() == 0) {
+      runcmd(cmd);
+    } else {
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -239,6 +298,30 @@ struct cmd* backcmd(struct cmd* subcmd) {
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
 }
+// Free cmd and its subcommands.
+void freecmd(struct cmd* cmd) {
+  if (cmd == 0)
+    return;
+
+  switch (cmd->type) {
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
+
 // PAGEBREAK!
 //  Parsing
 
@@ -303,16 +386,33 @@ struct cmd* parsepipe(char**, char*);
 struct cmd* parseexec(char**, char*);
 struct cmd* nulterminate(struct cmd*);
 
+// Set by the parser on a syntax error. The parser runs in
+// the shell itself, which must not exit on a bad line.
+int parseerr;
+
+void syntax(char* s) {
+  if (!parseerr)
+    fprintf(2, "%s\n", s);
+  parseerr = 1;
+}
+
+// Parse s. Returns 0 and frees what was parsed
+// if s has a syntax error.
 struct cmd* parsecmd(char* s) {
   char* es;
   struct cmd* cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if (s != es) {
+  if (s != es && !parseerr) {
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if (parseerr) {
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -350,8 +450,10 @@ struct cmd* parseredirs(struct cmd* cmd, char** ps, char* es) {
 
   while (peek(ps, es, "<>")) {
     tok = gettoken(ps, es, 0, 0);
-    if (gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if (gettoken(ps, es, &q, &eq) != 'a') {
+      syntax("missing file for redirection");
+      break;
+    }
     switch (tok) {
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -375,7 +477,7 @@ struct cmd* parseblock(char** ps, char* es) {
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
   if (!peek(ps, es, ")"))
-    panic("syntax - missing )");
+    syntax("syntax - missing )");
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -398,13 +500,17 @@ struct cmd* parseexec(char** ps, char* es) {
   while (!peek(ps, es, "|)&;")) {
     if ((tok = gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if (tok != 'a')
-      panic("syntax");
+    if (tok != 'a') {
+      syntax("syntax");
+      break;
+    }
+    if (argc + 1 >= MAXARGS) {
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if (argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
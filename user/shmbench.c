@@ -0,0 +1,123 @@
+#include "kernel/core/type.h"
+#include "user/user.h"
+
+// Compare producer/consumer throughput of a shared memory
+// ring buffer with that of a pipe.
+//
+//   shmbench [megabytes]
+
+#define CHUNK 512
+#define NSLOTS 16
+#define KEY 0x5b
+
+struct ring {
+  volatile uint head; // next slot the producer fills
+  volatile uint tail; // next slot the consumer empties
+  char data[NSLOTS][CHUNK];
+};
+
+int pipebench(int total) {
+  int fds[2];
+  char buf[CHUNK];
+
+  if (pipe(fds) < 0) {
+    fprintf(2, "shmbench: pipe failed\n");
+    exit(1);
+  }
+
+  int start = uptime();
+  int pid = fork();
+  if (pid < 0) {
+    fprintf(2, "shmbench: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    memset(buf, 'p', sizeof(buf));
+    for (int n = 0; n < total; n += CHUNK) {
+      if (write(fds[1], buf, CHUNK) != CHUNK)
+        exit(1);
+    }
+    exit(0);
+  }
+
+  close(fds[1]);
+  int got = 0;
+  for (int n; (n = read(fds[0], buf, sizeof(buf))) > 0;)
+    got += n;
+  close(fds[0]);
+  wait(0);
+
+  if (got != total) {
+    fprintf(2, "shmbench: pipe lost data\n");
+    exit(1);
+  }
+  return uptime() - start;
+}
+
+int shmbench(int total) {
+  char buf[CHUNK];
+
+  int id = shmget(KEY, sizeof(struct ring));
+  if (id < 0) {
+    fprintf(2, "shmbench: shmget failed\n");
+    exit(1);
+  }
+  struct ring* r = shmat(id);
+  if (r == (struct ring*)-1) {
+    fprintf(2, "shmbench: shmat failed\n");
+    exit(1);
+  }
+  r->head = r->tail = 0;
+
+  int start = uptime();
+  int pid = fork();
+  if (pid < 0) {
+    fprintf(2, "shmbench: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    // the attachment is inherited
+    memset(buf, 's', sizeof(buf));
+    for (int n = 0; n < total; n += CHUNK) {
+      while (r->head - r->tail == NSLOTS)
+        ;
+      memmove(r->data[r->head % NSLOTS], buf, CHUNK);
+      __sync_synchronize();
+      r->head++;
+    }
+    exit(0);
+  }
+
+  int got = 0;
+  while (got < total) {
+    while (r->tail == r->head)
+      ;
+    __sync_synchronize();
+    memmove(buf, r->data[r->tail % NSLOTS], CHUNK);
+    r->tail++;
+    got += CHUNK;
+  }
+  wait(0);
+  int ticks = uptime() - start;
+
+  if (shmdt(r) < 0) {
+    fprintf(2, "shmbench: shmdt failed\n");
+    exit(1);
+  }
+  return ticks;
+}
+
+int main(int argc, char* argv[]) {
+  int mb = argc > 1 ? atoi(argv[1]) : 4;
+  if (mb <= 0) {
+    fprintf(2, "usage: shmbench [megabytes]\n");
+    exit(1);
+  }
+  int total = mb * 1024 * 1024;
+
+  int p = pipebench(total);
+  int s = shmbench(total);
+  printf("shmbench: %d MiB in %d byte chunks: pipe %d ticks, shm %d ticks\n", mb, CHUNK, p, s);
+  exit(0);
+}
@@ -0,0 +1,67 @@
+#include "kernel/core/type.h"
+#include "user/user.h"
+
+// Compare the throughput of starting a program with
+// fork+exec+wait and with spawn+wait. The parent first
+// touches a heap of the given size, which fork shares
+// copy-on-write with each child only for exec to drop it.
+//
+//   spawnbench [rounds [heap-kilobytes]]
+
+int forkexec(char** argv, int rounds) {
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      fprintf(2, "spawnbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      exec(argv[0], argv);
+      fprintf(2, "spawnbench: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  return uptime() - start;
+}
+
+int spawnwait(char** argv, int rounds) {
+  int fds[3] = {0, 1, 2};
+
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    if (spawn(argv[0], argv, fds) < 0) {
+      fprintf(2, "spawnbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  return uptime() - start;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && strcmp(argv[1], "-child") == 0)
+    exit(0);
+
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  int heapkb = argc > 2 ? atoi(argv[2]) : 256;
+  if (rounds <= 0 || heapkb < 0) {
+    fprintf(2, "usage: spawnbench [rounds [heap-kilobytes]]\n");
+    exit(1);
+  }
+
+  char* heap = sbrk(heapkb * 1024);
+  if (heap == (char*)-1) {
+    fprintf(2, "spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < heapkb * 1024; i += 4096)
+    heap[i] = 1;
+
+  char* cargv[] = {"spawnbench", "-child", 0};
+  int f = forkexec(cargv, rounds);
+  int s = spawnwait(cargv, rounds);
+  printf("spawnbench: %d rounds, %d KiB heap: fork+exec %d ticks, spawn %d ticks\n", rounds, heapkb, f, s);
+  exit(0);
+}
@@ -0,0 +1,47 @@
+#include "kernel/core/type.h"
+#include "kernel/alloc/memctl.h"
+#include "user/user.h"
+
+// Compare a syscall-heavy loop with the TLB flushed on every
+// switch between user and kernel page tables, and with each
+// process keeping its translations under its own ASID.
+// Each round touches a working set of pages, then makes a
+// system call.
+//
+//   tlbbench [rounds]
+
+#define NPAGES 32
+#define PGSIZE 4096
+
+static char pages[NPAGES * PGSIZE];
+
+int bench(int rounds) {
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    for (int j = 0; j < NPAGES; j++)
+      pages[j * PGSIZE + i % PGSIZE]++;
+    getpid();
+  }
+  return uptime() - start;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+  if (rounds <= 0) {
+    fprintf(2, "usage: tlbbench [rounds]\n");
+    exit(1);
+  }
+
+  bench(1); // fault the working set in
+
+  memctl(MEMCTL_ASID, 0);
+  int flush = bench(rounds);
+  if (memctl(MEMCTL_ASID, 1) < 0) {
+    printf("tlbbench: %d rounds: flush %d ticks, no ASIDs\n", rounds, flush);
+    exit(0);
+  }
+  int asid = bench(rounds);
+
+  printf("tlbbench: %d rounds of %d pages: flush %d ticks, asid %d ticks\n", rounds, NPAGES, flush, asid);
+  exit(0);
+}
@@ -1,6 +1,7 @@
 #include "kernel/core/type.h"
 
 struct stat;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -26,6 +27,15 @@ int sleep(int);
 int uptime(void);
 int dump();
 int dump2(int pid, int register_num, uint64* return_value);
+int memctl(int op, int arg);
+int memstat(struct memstat*);
+void* mmap(void* addr, uint64 len, int prot, int flags, int fd, int off);
+int munmap(void* addr, uint64 len);
+int shmget(int key, int size);
+void* shmat(int id);
+int shmdt(void* addr);
+int spawn(const char* path, char** argv, int* fds);
+int stacklimit(int npages);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -8,6 +8,8 @@
 #include "kernel/hardware/memlayout.h"
 #include "kernel/hardware/riscv.h"
 #include "kernel/file/fcntl.h"
+#include "kernel/alloc/memstat.h"
+#include "kernel/alloc/memctl.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2050,6 +2052,27 @@ void kernmem(char* s) {
   }
 }
 
+// the heap is not executable: jumping into it must kill the
+// process rather than fault forever.
+void execheap(char* s) {
+  int pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    uint32* code = (uint32*)sbrk(PGSIZE);
+    code[0] = 0x00008067; // ret
+    ((void (*)(void))code)();
+    printf("%s: oops could execute the heap\n", s);
+    exit(1);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if (xstatus != -1) // did kernel kill child?
+    exit(1);
+}
+
 // user code should not be able to write to addresses above MAXVA.
 void MAXVAplus(char* s) {
   volatile uint64 a = MAXVA;
@@ -2123,11 +2146,13 @@ void sbrkfail(char* s) {
   if (pid == 0) {
     // allocate a lot of memory.
     // this should produce a page fault,
-    // and thus not complete.
+    // and thus not complete. loads alone
+    // would all map the shared zero page.
     a = sbrk(0);
     sbrk(10 * BIG);
     int n = 0;
     for (i = 0; i < 10 * BIG; i += PGSIZE) {
+      *(a + i) = 1;
       n += *(a + i);
     }
     // print n so the compiler doesn't optimize away
@@ -2292,18 +2317,59 @@ void argptest(char* s) {
   close(fd);
 }
 
-// check that there's an invalid page beneath
-// the user stack, to catch stack overflow.
+// use about n KiB of stack.
+int recurse(int n) {
+  volatile char frame[1024];
+  frame[0] = n;
+  if (n == 0)
+    return 0;
+  return recurse(n - 1) + frame[0];
+}
+
+// check that the user stack grows on demand, that it does
+// not come back once sbrk() gives it up, and that there's
+// an invalid page beneath its limit, to catch stack overflow.
 void stacktest(char* s) {
   int pid;
   int xstatus;
 
   pid = fork();
   if (pid == 0) {
-    char* sp = (char*)r_sp();
-    sp -= PGSIZE;
-    // the *sp should cause a trap.
-    printf("%s: stacktest: read below stack %p\n", s, *sp);
+    // far more than the one page exec() allocates.
+    recurse(64);
+    exit(0);
+  } else if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) {
+    printf("%s: stacktest: stack did not grow\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if (pid == 0) {
+    // free the page the stack is in; the next push must trap.
+    char c;
+    sbrk(PGROUNDDOWN((uint64)&c) - (uint64)sbrk(0));
+    recurse(4);
+    exit(0);
+  } else if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if (xstatus != -1) {
+    printf("%s: stacktest: stack came back above the break\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if (pid == 0) {
+    // the guard page below the limit should cause a trap.
+    recurse(stacklimit(0) * (PGSIZE / 1024) + 16);
+    printf("%s: stacktest: recursed past the stack limit\n", s);
     exit(1);
   } else if (pid < 0) {
     printf("%s: fork failed\n", s);
@@ -2406,6 +2472,28 @@ void sbrkbugs(char* s) {
   exit(0);
 }
 
+// a process that gives back all its memory, text included,
+// must die on its next instruction. faulting the text back
+// in above p->sz left pages that exit() did not free,
+// and freewalk() panicked.
+void sbrktext(char* s) {
+  int pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    sbrk(-(uint64)sbrk(0));
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if (xstatus != -1) {
+    printf("%s: ran without its text, status %d\n", s, xstatus);
+    exit(1);
+  }
+}
+
 // if process size was somewhat more than a page boundary, and then
 // shrunk to be somewhat less than that page boundary, can the kernel
 // still copyin() from addresses in the last page?
@@ -2451,6 +2539,426 @@ void badarg(char* s) {
   exit(0);
 }
 
+// spawn echo with its stdout on a pipe, check what it wrote
+// and that the parent's other fds did not leak into it.
+void spawntest(char* s) {
+  int fds[2], cfds[3];
+  char buf[16];
+  char* argv[] = {"echo", "spawned", 0};
+
+  if (pipe(fds) < 0) {
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  cfds[0] = 0;
+  cfds[1] = fds[1];
+  cfds[2] = 2;
+  if (spawn("echo", argv, cfds) < 0) {
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+
+  // EOF only comes if the child did not inherit fds[1] twice.
+  int n = 0;
+  for (int m; (m = read(fds[0], buf + n, sizeof(buf) - 1 - n)) > 0;)
+    n += m;
+  close(fds[0]);
+  buf[n] = 0;
+  int xstatus;
+  wait(&xstatus);
+  if (xstatus != 0 || strcmp(buf, "spawned\n") != 0) {
+    printf("%s: child wrote %s\n", s, buf);
+    exit(1);
+  }
+
+  cfds[1] = 1;
+  if (spawn("nosuchprogram", argv, cfds) >= 0) {
+    printf("%s: spawn of missing program succeeded\n", s);
+    exit(1);
+  }
+  cfds[1] = 100;
+  if (spawn("echo", argv, cfds) >= 0) {
+    printf("%s: spawn with a bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+// loads from fresh heap pages should all map the shared
+// zero page, and a store should give only that page a
+// private copy. read() into a read-only mapping of the
+// zero page must fail rather than write the zero page.
+void zeropage(char* s) {
+  enum { N = 64 };
+  struct memstat before, after;
+
+  memstat(&before);
+  char* p = sbrk(N * PGSIZE);
+  if (p == (char*)-1) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for (int i = 0; i < N; i++) {
+    if (p[i * PGSIZE] != 0 || p[i * PGSIZE + PGSIZE - 1] != 0) {
+      printf("%s: fresh heap not zero\n", s);
+      exit(1);
+    }
+  }
+  memstat(&after);
+  if (after.zero_maps - before.zero_maps < N) {
+    printf("%s: only %l loads mapped the zero page\n", s, after.zero_maps - before.zero_maps);
+    exit(1);
+  }
+
+  p[PGSIZE] = 'x';
+  if (p[0] != 0 || p[PGSIZE] != 'x' || p[2 * PGSIZE] != 0) {
+    printf("%s: store leaked into the zero page\n", s);
+    exit(1);
+  }
+
+  char* r = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (r == (char*)-1) {
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  if (r[0] != 0) {
+    printf("%s: fresh mapping not zero\n", s);
+    exit(1);
+  }
+  int fd = open("README", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if (read(fd, r, 64) > 0) {
+    printf("%s: read() into a read-only mapping succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  munmap(r, PGSIZE);
+  if (p[3 * PGSIZE] != 0 || p[3 * PGSIZE + 63] != 0) {
+    printf("%s: read() wrote the zero page\n", s);
+    exit(1);
+  }
+  sbrk(-N * PGSIZE);
+}
+
+// a program run twice should find its text in the text
+// cache the second time.
+void textshare(char* s) {
+  struct memstat before, after;
+  char* argv[] = {"echo", 0};
+  int cfds[3] = {0, -1, 2};
+
+  for (int i = 0; i < 2; i++) {
+    if (i == 1)
+      memstat(&before);
+    if (spawn("echo", argv, cfds) < 0) {
+      printf("%s: spawn failed\n", s);
+      exit(1);
+    }
+    wait(0);
+  }
+  memstat(&after);
+  if (after.text_hits == before.text_hits) {
+    printf("%s: text of echo was not shared\n", s);
+    exit(1);
+  }
+}
+
+// stores to an aligned 2 MiB of heap should map a megapage,
+// which a forked child shares copy-on-write, and which a
+// partial sbrk() shrink splits without losing the rest.
+void megapage(char* s) {
+  enum { MEGA = 2 * 1024 * 1024 };
+  struct memstat before, after;
+  int pid, xstatus;
+
+  if (memctl(MEMCTL_PROBE, 9) <= 0)
+    return; // no free block of that size to map
+  memstat(&before);
+  char* top = sbrk(0);
+  char* p = sbrk(2 * MEGA);
+  if (p == (char*)-1) {
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  char* m = (char*)(((uint64)p + MEGA - 1) & ~(uint64)(MEGA - 1));
+  for (int i = 0; i < MEGA; i += PGSIZE)
+    m[i] = i / PGSIZE;
+  memstat(&after);
+  if (after.mega_maps == before.mega_maps) {
+    printf("%s: no megapage was mapped\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    m[PGSIZE] = 'c';
+    exit(m[0] == 0 && m[2 * PGSIZE] == 2 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if (xstatus != 0 || m[PGSIZE] != 1) {
+    printf("%s: megapage not copied on write\n", s);
+    exit(1);
+  }
+
+  // cut the megapage in half.
+  if (sbrk(-(int)(top + 2 * MEGA - (m + MEGA / 2))) == (char*)-1) {
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for (int i = 0; i < MEGA / 2; i += PGSIZE) {
+    if (m[i] != (char)(i / PGSIZE)) {
+      printf("%s: split megapage lost data\n", s);
+      exit(1);
+    }
+  }
+  sbrk(top - sbrk(0));
+}
+
+// read() a file into an untouched private mapping of the
+// same file: the page must be read in from the file before
+// read() locks the inode and its buffers.
+void mmapread(char* s) {
+  char buf[64];
+  int fd = open("README", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  char* p = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (p == (char*)-1) {
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if (read(fd, p + 100, sizeof(buf)) != sizeof(buf)) {
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("README", O_RDONLY);
+  if (read(fd, buf, sizeof(buf)) != sizeof(buf) || memcmp(buf, p + 100, sizeof(buf)) != 0) {
+    printf("%s: read into mapping got wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  munmap(p, PGSIZE);
+}
+
+int main(int, char*[]);
+
+// read() into program text must fail rather than write the
+// page the text cache shares with every run of the program;
+// a second run must still work.
+void textread(char* s) {
+  char saved[64];
+  char* text = (char*)main;
+  char* argv[] = {"usertests", "zeropage", 0};
+  int cfds[3] = {0, -1, 2};
+  int xstatus;
+
+  memmove(saved, text, sizeof(saved));
+  int fd = open("README", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if (read(fd, text, sizeof(saved)) > 0) {
+    printf("%s: read() into text succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  if (memcmp(saved, text, sizeof(saved)) != 0) {
+    printf("%s: read() changed the text\n", s);
+    exit(1);
+  }
+
+  if (spawn("usertests", argv, cfds) < 0) {
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if (xstatus != 0) {
+    printf("%s: second run of usertests failed\n", s);
+    exit(1);
+  }
+}
+
+// mmap a file shared, store through the mapping, and check
+// that the file sees the stores after munmap; check that a
+// shared anonymous mapping is shared with a child.
+void mmaptest(char* s) {
+  enum { N = 2 * PGSIZE + 100 };
+  char buf[64];
+  int fd, pid, xstatus;
+
+  fd = open("mmapfile", O_CREATE | O_RDWR);
+  if (fd < 0) {
+    printf("%s: create mmapfile failed\n", s);
+    exit(1);
+  }
+  for (int i = 0; i < N; i += sizeof(buf)) {
+    memset(buf, 'a', sizeof(buf));
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      printf("%s: write mmapfile failed\n", s);
+      exit(1);
+    }
+  }
+
+  char* p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == (char*)-1) {
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if (p[0] != 'a' || p[N - 1] != 'a') {
+    printf("%s: mmap read wrong data\n", s);
+    exit(1);
+  }
+  p[PGSIZE] = 'b';
+  p[2 * PGSIZE + 1] = 'c';
+  if (munmap(p, N) != 0) {
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  char c1 = 0, c2 = 0;
+  for (int i = 0; i <= 2 * PGSIZE + 1; i++) {
+    char c;
+    if (read(fd, &c, 1) != 1) {
+      printf("%s: read mmapfile failed\n", s);
+      exit(1);
+    }
+    if (i == PGSIZE)
+      c1 = c;
+    if (i == 2 * PGSIZE + 1)
+      c2 = c;
+  }
+  close(fd);
+  if (c1 != 'b' || c2 != 'c') {
+    printf("%s: stores through mmap were not written back\n", s);
+    exit(1);
+  }
+
+  // stores by the kernel, as read() does, must be written back too.
+  fd = open("mmapfile", O_RDWR);
+  p = mmap(0, N, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == (char*)-1) {
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  int fd2 = open("README", O_RDONLY);
+  if (read(fd2, p + PGSIZE, sizeof(buf)) != sizeof(buf)) {
+    printf("%s: read into mmap failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  munmap(p, N);
+  close(fd);
+  char buf2[64];
+  fd = open("mmapfile", O_RDONLY);
+  fd2 = open("README", O_RDONLY);
+  read(fd2, buf2, sizeof(buf2));
+  close(fd2);
+  for (int i = 0; i < PGSIZE; i += sizeof(buf))
+    read(fd, buf, sizeof(buf));
+  if (read(fd, buf, sizeof(buf)) != sizeof(buf) || memcmp(buf, buf2, sizeof(buf)) != 0) {
+    printf("%s: read() into mmap was not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  int* shared = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == (int*)-1) {
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if (pid == 0) {
+    *shared = 42;
+    exit(0);
+  }
+  wait(&xstatus);
+  if (xstatus != 0 || *shared != 42) {
+    printf("%s: anonymous mapping not shared\n", s);
+    exit(1);
+  }
+  munmap(shared, PGSIZE);
+
+  // a shared mapping no one can touch must not keep fork() from working.
+  char* none = mmap(0, PGSIZE, 0, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (none == (char*)-1) {
+    printf("%s: PROT_NONE mmap failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if (pid < 0) {
+    printf("%s: fork with a PROT_NONE mapping failed\n", s);
+    exit(1);
+  }
+  if (pid == 0)
+    exit(0);
+  wait(0);
+  munmap(none, PGSIZE);
+}
+
+// the file of a running program is read in on demand, so
+// it must not be opened for writing or truncated.
+void textbusy(char* s) {
+  int fd = open("usertests", O_RDWR);
+  if (fd >= 0) {
+    printf("%s: opened the running program for writing\n", s);
+    exit(1);
+  }
+  fd = open("usertests", O_RDONLY | O_TRUNC);
+  if (fd >= 0) {
+    printf("%s: truncated the running program\n", s);
+    exit(1);
+  }
+  fd = open("usertests", O_RDONLY);
+  if (fd < 0) {
+    printf("%s: open for reading failed\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// a segment that is created and never attached must go
+// away when its creator exits, or the table fills up.
+void shmleak(char* s) {
+  enum { N = 40 };
+
+  for (int i = 0; i < N; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if (pid == 0) {
+      if (shmget(1000 + i, PGSIZE) < 0) {
+        printf("%s: shmget %d failed\n", s, i);
+        exit(1);
+      }
+      exit(0);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0)
+      exit(1);
+  }
+}
+
 struct test {
   void (*f)(char*);
   char* s;
@@ -2501,6 +3009,7 @@ struct test {
     {sbrkbasic,    "sbrkbasic"   },
     {sbrkmuch,     "sbrkmuch"    },
     {kernmem,      "kernmem"     },
+    {execheap,     "execheap"    },
     {MAXVAplus,    "MAXVAplus"   },
     {sbrkfail,     "sbrkfail"    },
     {sbrkarg,      "sbrkarg"     },
@@ -2512,9 +3021,19 @@ struct test {
     {textwrite,    "textwrite"   },
     {pgbug,        "pgbug"       },
     {sbrkbugs,     "sbrkbugs"    },
+    {sbrktext,     "sbrktext"    },
     {sbrklast,     "sbrklast"    },
     {sbrk8000,     "sbrk8000"    },
     {badarg,       "badarg"      },
+    {mmaptest,     "mmaptest"    },
+    {mmapread,     "mmapread"    },
+    {shmleak,      "shmleak"     },
+    {textbusy,     "textbusy"    },
+    {spawntest,    "spawntest"   },
+    {zeropage,     "zeropage"    },
+    {textshare,    "textshare"   },
+    {textread,     "textread"    },
+    {megapage,     "megapage"    },
 
     {0,            0             },
 };
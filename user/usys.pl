@@ -38,3 +38,12 @@ entry("sleep");
 entry("uptime");
 entry("dump");
 entry("dump2");
+entry("memctl");
+entry("memstat");
+entry("mmap");
+entry("munmap");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("spawn");
+entry("stacklimit");